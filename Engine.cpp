@@ -22,90 +22,273 @@
 */
 
 #define WIN32_LEAN_AND_MEAN
-#include "Engine.h"
+#include "EngineCore.h"
+
+#ifndef ENGINE_HEADLESS
+
 #include <windows.h>
+#include <shellapi.h>
+#include <mmsystem.h>
 #include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <string>
+
+#pragma comment(lib, "winmm.lib")
 
-uint32_t buffer[SCREEN_HEIGHT][SCREEN_WIDTH] = { 0 };
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#  define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
 
 static HINSTANCE hinst = 0;
+static HWND main_hwnd = NULL;
 static DWORD ticks = 0;
-static bool is_active = true;
-static POINT cursor_pos;
-static bool quited = false;
+static const uint32_t* present_buffer = NULL;
+
+// pipelined mode: a presented slot goes back to the ring and gets redrawn, WM_PAINT blits
+// this copy of the last presented frame instead, it is only touched by the window thread
+static uint32_t* front_buffer = NULL;
 static LARGE_INTEGER qpc_frequency = { 0 };
-static LARGE_INTEGER qpc_ref_time = { 0 };
+static bool high_resolution_timers = false;
+
+// last state pushed by the input thread
+static uint32_t sampled_keys[8] = { 0 };
+static bool sampled_buttons[2] = { false, false };
+static POINT sampled_cursor = { 0, 0 };
+static bool sampled_active = true;
 
-bool is_window_active()
+// waitable timers can't be shared between the threads that sleep (pacing, input)
+struct SleepTimer
 {
-  return is_active;
+  HANDLE handle;
+
+  SleepTimer() : handle(high_resolution_timers
+    ? CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS) : NULL) {}
+  ~SleepTimer() { if (handle) CloseHandle(handle); }
+};
+
+double platform_now()
+{
+  LARGE_INTEGER t;
+  QueryPerformanceCounter(&t);
+  return double(t.QuadPart) / double(qpc_frequency.QuadPart);
 }
 
-void clear_buffer()
+void platform_sleep(double seconds)
 {
-  memset(buffer, 0, sizeof(buffer));
+  static thread_local SleepTimer timer;
+
+  if (timer.handle)
+  {
+    LARGE_INTEGER due;
+    due.QuadPart = -LONGLONG(seconds * 10000000.0); // relative, 100 ns units
+    if (SetWaitableTimer(timer.handle, &due, 0, NULL, NULL, FALSE))
+    {
+      WaitForSingleObject(timer.handle, INFINITE);
+      return;
+    }
+  }
+  Sleep(DWORD(seconds * 1000.0));
 }
 
-bool is_key_pressed(int button_vk_code)
+float platform_refresh_rate()
 {
-  return is_active && (GetAsyncKeyState(button_vk_code) & 0x8000);
+  DEVMODEA dm = {};
+  dm.dmSize = sizeof(dm);
+  if (EnumDisplaySettingsA(NULL, ENUM_CURRENT_SETTINGS, &dm) && dm.dmDisplayFrequency > 1)
+    return float(dm.dmDisplayFrequency);
+  return 0.0f;
 }
 
-bool is_mouse_button_pressed(int mouse_button_index)
+static void print_debug_line(const char* line)
 {
-  if (!is_active)
-    return false;
+  OutputDebugStringA(line);
+  OutputDebugStringA("\n");
+}
+
+// input thread: pushes what changed since the previous sample, a change that didn't fit
+// into the ring is retried next time
+static void sample_input(double now)
+{
+  bool active = GetForegroundWindow() == main_hwnd;
+  if (active != sampled_active)
+  {
+    InputEvent event = { now, InputEvent::WINDOW_ACTIVE, 0, active };
+    if (engine_push_input(event))
+      sampled_active = active;
+  }
+
+  POINT cursor;
+  if (GetCursorPos(&cursor) && ScreenToClient(main_hwnd, &cursor)
+    && (cursor.x != sampled_cursor.x || cursor.y != sampled_cursor.y))
+  {
+    InputEvent event = { now, InputEvent::CURSOR, 0, false, cursor.x, cursor.y };
+    if (engine_push_input(event))
+      sampled_cursor = cursor;
+  }
 
-  if (mouse_button_index == 0)
-    return GetAsyncKeyState(VK_LBUTTON) != 0;
+  static const int button_vk_codes[2] = { VK_LBUTTON, VK_RBUTTON };
+  for (int button = 0; button < 2; button++)
+  {
+    bool pressed = (GetAsyncKeyState(button_vk_codes[button]) & 0x8000) != 0;
+    if (pressed != sampled_buttons[button])
+    {
+      InputEvent event = { now, InputEvent::MOUSE_BUTTON, uint8_t(button), pressed };
+      if (engine_push_input(event))
+        sampled_buttons[button] = pressed;
+    }
+  }
 
-  if (mouse_button_index == 1)
-    return GetAsyncKeyState(VK_RBUTTON) != 0;
+  for (int code = 0; code < 256; code++)
+  {
+    if (!engine_is_key_watched(code))
+      continue;
 
-  return false;
+    const uint32_t bit = 1u << (code & 31);
+    bool pressed = (GetAsyncKeyState(code) & 0x8000) != 0;
+    if (pressed != ((sampled_keys[code >> 5] & bit) != 0))
+    {
+      InputEvent event = { now, InputEvent::KEY, uint8_t(code), pressed };
+      if (engine_push_input(event))
+        sampled_keys[code >> 5] ^= bit;
+    }
+  }
 }
 
-int get_cursor_x()
+// copies rows top..bottom-1, columns left..right-1 of pixels to the same place in the window
+static void blit(HDC hdc, const uint32_t* pixels, int left, int top, int right, int bottom)
 {
-  return cursor_pos.x;
+  // the DIB starts at the first copied row, so it doesn't matter how the source y is counted
+  BITMAPINFOHEADER bih;
+  bih.biSize = sizeof(bih);
+  bih.biWidth = buffer.stride;
+  bih.biHeight = -(bottom - top);
+  bih.biPlanes = 1;
+  bih.biBitCount = 32;
+  bih.biCompression = BI_RGB;
+  bih.biSizeImage = 0;
+  bih.biXPelsPerMeter = 96;
+  bih.biYPelsPerMeter = 96;
+  bih.biClrUsed = 0;
+  bih.biClrImportant = 0;
+  SetDIBitsToDevice(
+    hdc,
+    left, top,
+    right - left, bottom - top,
+    left, 0,
+    0, bottom - top,
+    pixels + ptrdiff_t(top) * buffer.stride,
+    (BITMAPINFO*)&bih,
+    DIB_RGB_COLORS);
 }
 
-int get_cursor_y()
+static void copy_rect(uint32_t* dst, const uint32_t* src, int left, int top, int right, int bottom)
 {
-  return cursor_pos.y;
+  for (int y = top; y < bottom; y++)
+    memcpy(dst + ptrdiff_t(y) * buffer.stride + left, src + ptrdiff_t(y) * buffer.stride + left,
+      (right - left) * sizeof(uint32_t));
 }
 
-void schedule_quit_game()
+static void present(HWND hwnd, int slot)
 {
-  quited = true;
+  ProfileScope profile(PROFILE_PRESENT);
+
+  DirtyRegion region;
+  engine_take_present_region(slot, &region);
+
+  present_buffer = engine_backbuffer(slot);
+  // indexed frames are already expanded into a buffer of this thread
+  if (engine_is_pipelined() && !engine_is_indexed())
+  {
+    if (!front_buffer)
+    {
+      front_buffer = (uint32_t*)malloc(size_t(buffer.stride) * buffer.height * sizeof(uint32_t));
+      if (!front_buffer)
+        abort();
+      region.full = true;
+    }
+
+    // the region holds everything changed since the previous present, so the copy stays whole
+    if (region.full)
+      copy_rect(front_buffer, present_buffer, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+    else
+    {
+      for (int i = 0; i < region.count; i++)
+      {
+        const DirtyRect& rect = region.rects[i];
+        copy_rect(front_buffer, present_buffer, rect.left, rect.top, rect.right, rect.bottom);
+      }
+    }
+    present_buffer = front_buffer;
+  }
+
+  HDC hdc = GetDC(hwnd);
+  if (region.full)
+    blit(hdc, present_buffer, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+  else
+  {
+    for (int i = 0; i < region.count; i++)
+    {
+      const DirtyRect& rect = region.rects[i];
+      blit(hdc, present_buffer, rect.left, rect.top, rect.right, rect.bottom);
+    }
+  }
+  ReleaseDC(hwnd, hdc);
 }
 
 static void CALLBACK update_proc(HWND hwnd)
 {
-  if (quited)
+  if (engine_is_quit_scheduled())
     return;
 
-  is_active = GetActiveWindow() == hwnd;
-
-  GetCursorPos(&cursor_pos);
-  ScreenToClient(hwnd, &cursor_pos);
+  if (engine_frame(platform_now()))
+  {
+    present(hwnd, 0);
+    engine_capture_frame(engine_backbuffer(0), buffer.stride);
+  }
+}
 
-  LARGE_INTEGER t;
-  QueryPerformanceCounter(&t);
+static void CALLBACK present_proc(HWND hwnd)
+{
+  int slot = engine_pipeline_acquire(0.05);
+  if (slot < 0)
+    return;
 
-  float dt = float((unsigned long)(t.QuadPart - qpc_ref_time.QuadPart)) / qpc_frequency.QuadPart;
-  if (dt > 0.1f)
-    dt = 0.1f;
+  present(hwnd, slot);
+  engine_capture_frame(engine_backbuffer(slot), buffer.stride);
+  engine_pipeline_release(slot);
+}
 
-  act(dt);
+static bool parse_command_line()
+{
+  int argc = 0;
+  LPWSTR* wargv = CommandLineToArgvW(GetCommandLineW(), &argc);
+  if (!wargv)
+    return false;
 
-  if (!quited)
+  std::vector<std::string> args(argc);
+  std::vector<char*> argv(argc);
+  for (int i = 0; i < argc; i++)
   {
-    draw();
-    RedrawWindow(hwnd, NULL, 0, RDW_INVALIDATE | RDW_UPDATENOW);
+    int len = WideCharToMultiByte(CP_UTF8, 0, wargv[i], -1, NULL, 0, NULL, NULL);
+    args[i].resize(len > 0 ? len : 1);
+    WideCharToMultiByte(CP_UTF8, 0, wargv[i], -1, &args[i][0], len, NULL, NULL);
+    argv[i] = &args[i][0];
   }
+  LocalFree(wargv);
 
-  qpc_ref_time = t;
+  for (int i = 1; i < argc;)
+  {
+    int used = engine_parse_option(argc, argv.data(), i);
+    if (!used)
+    {
+      std::string usage = std::string("usage: game ") + engine_options_usage();
+      MessageBoxA(NULL, usage.c_str(), "Game", MB_OK | MB_ICONERROR);
+      return false;
+    }
+    i += used;
+  }
+  return true;
 }
 
 static LRESULT CALLBACK WndProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
@@ -117,34 +300,19 @@ static LRESULT CALLBACK WndProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM l
       PAINTSTRUCT ps;
       HDC hdc = BeginPaint(hwnd, &ps);
 
-      BITMAPINFOHEADER bih;
-      bih.biSize = sizeof(bih);
-      bih.biWidth = SCREEN_WIDTH;
-      bih.biHeight = -SCREEN_HEIGHT;
-      bih.biPlanes = 1;
-      bih.biBitCount = 32;
-      bih.biCompression = BI_RGB;
-      bih.biSizeImage = 0;
-      bih.biXPelsPerMeter = 96;
-      bih.biYPelsPerMeter = 96;
-      bih.biClrUsed = 0;
-      bih.biClrImportant = 0;
-      SetDIBitsToDevice(
-        hdc,
-        0, 0,
-        SCREEN_WIDTH, SCREEN_HEIGHT,
-        0, 0,
-        0, SCREEN_HEIGHT,
-        buffer,
-        (BITMAPINFO*)&bih,
-        DIB_RGB_COLORS);
+      // the window was uncovered or resized, the frame presents only what changed; in pipelined
+      // mode nothing is shown before the first present, the slots are still being drawn
+      if (present_buffer)
+        blit(hdc, present_buffer, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+      else if (!engine_is_pipelined())
+        blit(hdc, engine_backbuffer(0), 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
 
       EndPaint(hwnd, &ps);
     }
   break;
   case WM_QUIT:
   case WM_DESTROY:
-    quited = true;
+    schedule_quit_game();
     break;
   default:
     return DefWindowProc(hwnd, message, wParam, lParam);
@@ -162,6 +330,27 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
   UNREFERENCED_PARAMETER(hPrevInstance);
   UNREFERENCED_PARAMETER(lpCmdLine);
 
+  QueryPerformanceFrequency(&qpc_frequency);
+
+  set_frame_pacing(FRAME_PACING_VSYNC, 0.0f);
+  if (!parse_command_line())
+    return 1;
+  engine_create_backbuffers();
+
+  if (engine_is_replaying())
+  {
+    engine_run_replay(print_debug_line);
+    return 0;
+  }
+
+  // high resolution waitable timers (Windows 10 1803+), 1 ms system timer otherwise
+  HANDLE probe = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+  high_resolution_timers = probe != NULL;
+  if (probe)
+    CloseHandle(probe);
+  else
+    timeBeginPeriod(1);
+
   WNDCLASSEXA wcex;
 
   wcex.cbSize = sizeof(WNDCLASSEX);
@@ -195,25 +384,43 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
   ShowWindow(hwnd, nCmdShow);
   UpdateWindow(hwnd);
 
-  QueryPerformanceFrequency(&qpc_frequency);
-  QueryPerformanceCounter(&qpc_ref_time);
-
   ticks = GetTickCount();
-  initialize();
+  main_hwnd = hwnd;
+  engine_input_thread_start(sample_input);
+  if (engine_is_pipelined())
+    engine_pipeline_start(platform_now, NULL);
+  else
+  {
+    initialize();
+    engine_start(platform_now());
+  }
+  engine_pacing_start();
 
   MSG msg;
-  while (!quited)
+  while (!engine_is_quit_scheduled())
   {
     while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
     {
       TranslateMessage(&msg);
       DispatchMessage(&msg);
     }
-    update_proc(hwnd);
-    Sleep(0);
+    if (engine_is_pipelined())
+      present_proc(hwnd);
+    else
+      update_proc(hwnd);
+    engine_wait_next_frame();
   }
 
+  if (engine_is_pipelined())
+    engine_pipeline_stop();
+  engine_input_thread_stop();
   finalize();
+  engine_shutdown(print_debug_line);
+
+  if (!high_resolution_timers)
+    timeEndPeriod(1);
 
   return (int)msg.wParam;
 }
+
+#endif // ENGINE_HEADLESS
@@ -25,11 +25,33 @@
 
 #include <stdint.h>
 
-#define SCREEN_WIDTH 1024
-#define SCREEN_HEIGHT 768
+// ENGINE_HEADLESS selects the offscreen backend (EngineHeadless.cpp) instead of WinAPI (Engine.cpp),
+// it is the only backend available outside of Windows
+#if !defined(_WIN32) && !defined(ENGINE_HEADLESS)
+#  define ENGINE_HEADLESS
+#endif
+
+#include <stddef.h>
+
+// backbuffer: width x height pixels, rows are stride pixels apart and start on a 64 byte boundary;
+// the size is picked at startup (--resolution WxH, 1024x768 by default) and never changes;
+// in indexed mode (--indexed) pixels is NULL and indices holds 1-byte palette indices instead,
+// so draw with fill_pixels(), which handles both
+struct Framebuffer {
+  uint32_t* pixels;
+  uint8_t* indices;
+  int width;
+  int height;
+  int stride;
+
+  uint32_t* operator[](int y) const { return pixels + ptrdiff_t(y) * stride; }
+};
+
+// the frame being drawn, buffer[y][x] (its pixels change between frames in pipelined mode)
+extern Framebuffer buffer;
 
-// backbuffer
-extern uint32_t buffer[SCREEN_HEIGHT][SCREEN_WIDTH];
+#define SCREEN_WIDTH (buffer.width)
+#define SCREEN_HEIGHT (buffer.height)
 
 #ifndef VK_ESCAPE
 #  define VK_ESCAPE 0x1B
@@ -41,7 +63,23 @@ extern uint32_t buffer[SCREEN_HEIGHT][SCREEN_WIDTH];
 #  define VK_RETURN 0x0D
 #endif
 
+// input is sampled on its own thread and handed to the game as one snapshot per act(),
+// all the queries below read the current snapshot and never call the OS
+struct InputSnapshot {
+  uint32_t keys[8];          // bit per VK code
+  bool mouse_buttons[2];
+  int cursor_x;
+  int cursor_y;
+  bool window_active;
+  double time;               // when the snapshot was taken (seconds, engine clock)
+  double oldest_event_time;  // sampling time of the oldest change folded in, 0 if none
+  uint32_t events;           // changes folded in since the previous snapshot
+};
+
+const InputSnapshot& get_input_snapshot();
+
 // VK_SPACE, VK_RIGHT, VK_LEFT, VK_UP, VK_DOWN, 'A', 'B' ...
+// a key is sampled from the first time it is asked about
 bool is_key_pressed(int button_vk_code);
 
 // 0 - left button, 1 - right button
@@ -52,7 +90,86 @@ int get_cursor_y();
 
 bool is_window_active();
 
+// draw() reports every pixel it draws with add_dirty_rect() (screen coordinates, right and bottom
+// excluded); clear_buffer() then erases only what the previous frame in this backbuffer drew
+// and only the changed part of the screen is presented
 void clear_buffer();
+void add_dirty_rect(int left, int top, int right, int bottom);
+
+// background layer for what doesn't move: clear_buffer() restores it instead of black. Draw calls
+// submitted between begin_background() and end_background() are rendered into the layer (it starts
+// black, nothing is reported dirty), then every backbuffer takes the whole new layer at its next
+// clear_buffer(). Call from draw() / draw_frame() before clear_buffer(), only when the layer changes.
+void begin_background();
+void end_background();
+
+// dst[0..count-1] = color, 32-bit pixels
+void fill_span(uint32_t* dst, int count, uint32_t color);
+// row y, columns x..x+count-1 of buffer = color, not clipped: the way to write pixels, shapes fill
+// whole row spans with it
+void fill_pixels(int y, int x, int count, uint32_t color);
+
+// part of the framebuffer a shape may write to, right and bottom excluded
+struct ClipRect {
+  int left;
+  int top;
+  int right;
+  int bottom;
+};
+
+// the whole framebuffer
+ClipRect get_screen_clip_rect();
+
+// row y, columns left..right-1, cut to clip (nothing if the row is outside)
+void fill_row(int y, int left, int right, uint32_t color, const ClipRect& clip);
+
+// any triangle (x - column, y - row): a pixel is filled when its center is inside, pixels
+// exactly on an edge go to the triangle on its right so neighbours sharing an edge don't overlap
+void fill_triangle(float x0, float y0, float x1, float y1, float x2, float y2, uint32_t color, const ClipRect& clip);
+
+// run of pixels in one row, right excluded
+struct ShapeSpan {
+  int row;
+  int left;
+  int right;
+};
+
+// spans fill_triangle() would fill (rows within clip, columns not cut), returns how many were
+// written, at most max_spans
+int triangle_spans(float x0, float y0, float x1, float y1, float x2, float y2, const ClipRect& clip,
+  ShapeSpan* spans, int max_spans);
+
+// pre-rasterized shapes: coverage stored as spans relative to the shape origin under a key of
+// whatever determines it, drawn with one fill_pixels() per span; the least recently used entries
+// are dropped past --shape-cache N entries. Safe to use from draw callbacks on any render thread.
+#define SHAPE_CACHE_DEFAULT_SIZE 256
+
+struct ShapeKey {
+  int type;
+  int orientation;
+  float width;
+  float height;
+};
+
+struct ShapeSpans;
+
+// NULL if the shape is not cached
+const ShapeSpans* find_shape_spans(const ShapeKey& key);
+// the result stays valid until the frame is rendered (entries are evicted only between frames)
+const ShapeSpans* store_shape_spans(const ShapeKey& key, const ShapeSpan* spans, int count);
+// spans with their origin at column x, row y; clip NULL - known to be inside the framebuffer
+void draw_shape_spans(const ShapeSpans* shape, int x, int y, uint32_t color, const ClipRect* clip);
+
+// tile rendering: draw() and draw_frame() submit draw calls instead of writing pixels, the engine
+// renders them right after it returns: every call is binned by its bounds into TILE_SIZE x TILE_SIZE
+// screen tiles, the tiles are rasterized by --render-threads threads, one thread per tile at a time,
+// calls within a tile in submission order. draw(data, clip) may run several times (once per tile)
+// and concurrently with other calls, it must write only inside clip and not change shared state.
+// size bytes at data are copied, bounds is in screen coordinates (right and bottom excluded).
+#define TILE_SIZE 64
+
+typedef void (*DrawCallback)(const void* data, const ClipRect& clip);
+void submit_draw(const ClipRect& bounds, DrawCallback draw, const void* data, size_t size);
 
 void initialize();
 void finalize();
@@ -60,4 +177,87 @@ void finalize();
 void act(float dt);
 void draw();
 
+// pipelined mode (--pipeline): act() and drawing run on two threads and overlap, frames go through
+// a ring of PIPELINE_DEPTH slots. After act() the simulation thread calls capture_frame(slot), which
+// copies everything needed to draw the frame; later the render thread calls draw_frame(slot) with
+// buffer pointing to the slot's backbuffer. draw() is not used in this mode.
+#define PIPELINE_DEPTH 3
+void capture_frame(int slot);
+void draw_frame(int slot);
+
 void schedule_quit_game();
+
+// seed for srand(): random per run, taken from the file when replaying (--replay) or from --seed
+unsigned get_random_seed();
+
+// fixed timestep: act() always gets dt = 1 / ticks_per_second and is called as many times per frame
+// as needed to catch up with the clock, but at most max_catch_up_steps (the rest is dropped);
+// ticks_per_second <= 0 - act() once per frame with the measured dt (default)
+void set_fixed_timestep(float ticks_per_second, int max_catch_up_steps);
+
+// position of the frame between the previous and the last act() (0..1, always 1 with variable dt),
+// draw() blends body positions with it
+float get_render_alpha();
+
+enum FramePacing {
+  FRAME_PACING_UNLIMITED,   // next frame right away
+  FRAME_PACING_TARGET_FPS,  // sleep until the next 1 / target_fps deadline
+  FRAME_PACING_VSYNC        // same, at the display refresh rate
+};
+
+struct FramePacingState {
+  FramePacing mode;
+  float target_fps;          // effective rate, 0 when unlimited
+  uint64_t frames;
+  uint64_t missed_deadlines; // frames that were not ready by their deadline
+  double frame_time;         // last frame, deadline to deadline (seconds)
+  double work_time;          // last frame without waiting
+  double sleep_time;         // last frame spent in the OS sleep
+  double spin_time;          // last frame spent spinning after the sleep
+  double sleep_overshoot;    // how late the OS sleep is expected to wake up
+};
+
+// the backend picks the default: VSYNC for the window, UNLIMITED for headless
+void set_frame_pacing(FramePacing mode, float target_fps);
+FramePacingState get_frame_pacing_state();
+
+// collision broadphase the game uses to find the pairs of bodies worth testing, picked with
+// --broadphase NAME so the algorithms can be compared on the same scene
+enum Broadphase {
+  BROADPHASE_BRUTE_FORCE, // "brute": every pair of bodies
+  BROADPHASE_GRID,        // "grid": bodies binned into a uniform grid every tick
+  BROADPHASE_SWEEP,       // "sweep": sweep and prune over endpoint lists kept sorted between ticks
+  BROADPHASE_TREE,        // "tree": dynamic bounding box tree updated as the bodies move (default)
+  BROADPHASE_COUNT
+};
+
+Broadphase get_broadphase();
+
+// frame profiling: time spent in each phase is summed per frame, the last frames are reported
+// as percentiles on exit (--profile FILE also writes them as CSV)
+enum ProfilePhase {
+  PROFILE_INPUT,      // input snapshot
+  PROFILE_INTEGRATE,  // bodies act()
+  PROFILE_COLLIDE,    // collision detection and response
+  PROFILE_SPAWN,      // creating and deleting bodies
+  PROFILE_DRAW,       // draw(), capture_frame() and draw_frame()
+  PROFILE_PRESENT,    // copying the backbuffer to the window
+  PROFILE_CAPTURE,    // copying the frame for --capture
+  PROFILE_PHASE_COUNT
+};
+
+// adds the time from construction to destruction to the phase, safe to use from any thread
+struct ProfileScope {
+  ProfileScope(ProfilePhase phase);
+  ~ProfileScope();
+
+  ProfilePhase phase;
+  double start;
+};
+
+#ifdef ENGINE_HEADLESS
+// input injection for the headless backend, seen by is_key_pressed() etc. from the next act()
+void headless_set_key_state(int button_vk_code, bool pressed);
+void headless_set_mouse_button_state(int button, bool pressed);
+void headless_set_cursor_pos(int x, int y);
+#endif
@@ -0,0 +1,305 @@
+/* MIT License
+ * 
+ * Copyright (c) 2024 Dmitry Shapovalov
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+// frame capture: every Nth presented frame is copied into one of two staging buffers and written
+// out by a writer thread, so the frame loop only pays for the copy; when the writer is still busy
+// with both buffers the frame is dropped rather than waited for (replays wait, nothing is lost)
+//
+//   --capture frames/%05d.ppm - one file per frame, the name is a printf pattern with one %d (or %i)
+//                               of the presented frame number, %% for a literal percent sign
+//   --capture frames.raw      - all frames into one file (raw RGBA, .ppm - concatenated PPMs)
+//   --capture "|command"      - raw RGBA frames into the command's stdin, e.g.
+//                               "|ffmpeg -f rawvideo -pix_fmt rgba -s 1024x768 -r 60 -i - out.mp4"
+
+#include "EngineCore.h"
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#ifdef _WIN32
+#  define popen _popen
+#  define pclose _pclose
+#  define PIPE_WRITE_MODE "wb"
+#else
+#  define PIPE_WRITE_MODE "w"
+#endif
+
+#define CAPTURE_STAGING 2
+
+struct CaptureStaging {
+  std::vector<uint32_t> pixels;  // width x height, no stride
+  uint64_t frame;
+  bool full;
+};
+
+static std::string target;
+static int interval = 1;
+static bool lossless = false;
+static bool to_pipe = false;
+static bool as_ppm = false;
+static bool per_frame_files = false;
+
+static bool started = false;
+static std::atomic<bool> failed(false);
+static FILE* stream = NULL;
+static int width = 0;
+static int height = 0;
+
+static CaptureStaging staging[CAPTURE_STAGING];
+static int next_staging = 0;
+static std::thread writer;
+static std::mutex staging_mutex;
+static std::condition_variable staging_changed;
+static bool stopping = false;
+
+static uint64_t presented_frames = 0;
+static uint64_t captured_frames = 0;
+static uint64_t dropped_frames = 0;
+static uint64_t written_bytes = 0;
+static double copy_time = 0.0;
+static double copy_time_max = 0.0;
+static double write_time = 0.0;
+
+// the name is passed to snprintf with a single int, so it must hold exactly one int conversion
+static bool is_frame_pattern(const char* pattern)
+{
+  int conversions = 0;
+  for (const char* c = pattern; *c; c++)
+  {
+    if (*c != '%')
+      continue;
+    if (*++c == '%')
+      continue;
+
+    c += strspn(c, "-+ #0");
+    c += strspn(c, "0123456789");
+    if (*c == '.')
+      c += 1 + strspn(c + 1, "0123456789");
+    if (*c != 'd' && *c != 'i')
+      return false;
+    conversions++;
+  }
+  return conversions == 1;
+}
+
+bool engine_set_capture(const char* path)
+{
+  target = path;
+  to_pipe = target[0] == '|';
+  per_frame_files = !to_pipe && target.find('%') != std::string::npos;
+  as_ppm = !to_pipe && target.size() > 4 && target.compare(target.size() - 4, 4, ".ppm") == 0;
+  if (per_frame_files && !is_frame_pattern(path))
+  {
+    fprintf(stderr, "bad capture pattern '%s', it needs one %%d for the frame number\n", path);
+    target.clear();
+    return false;
+  }
+  return target.size() > (to_pipe ? 1u : 0u);
+}
+
+void engine_set_capture_interval(int frames)
+{
+  interval = frames > 0 ? frames : 1;
+}
+
+void engine_set_capture_lossless(bool enable)
+{
+  lossless = enable;
+}
+
+static void write_frame(const CaptureStaging& frame)
+{
+  FILE* f = stream;
+  if (per_frame_files)
+  {
+    char name[1024];
+    snprintf(name, sizeof(name), target.c_str(), int(frame.frame));
+    f = fopen(name, "wb");
+    if (!f)
+    {
+      failed = true;
+      return;
+    }
+  }
+
+  const int channels = as_ppm ? 3 : 4;
+  if (as_ppm)
+    written_bytes += fprintf(f, "P6\n%d %d\n255\n", width, height);
+
+  // buffer pixels are 0x00RRGGBB
+  std::vector<uint8_t> row(size_t(width) * channels);
+  for (int y = 0; y < height; y++)
+  {
+    const uint32_t* src = &frame.pixels[size_t(y) * width];
+    uint8_t* dst = row.data();
+    for (int x = 0; x < width; x++, dst += channels)
+    {
+      dst[0] = uint8_t(src[x] >> 16);
+      dst[1] = uint8_t(src[x] >> 8);
+      dst[2] = uint8_t(src[x]);
+      if (channels == 4)
+        dst[3] = 255;
+    }
+    if (fwrite(row.data(), 1, row.size(), f) != row.size())
+      failed = true;
+    written_bytes += row.size();
+  }
+
+  if (per_frame_files)
+    fclose(f);
+}
+
+static void writer_proc()
+{
+  for (int index = 0;; index = (index + 1) % CAPTURE_STAGING)
+  {
+    {
+      std::unique_lock<std::mutex> lock(staging_mutex);
+      staging_changed.wait(lock, [index] { return staging[index].full || stopping; });
+      if (!staging[index].full)
+        break;
+    }
+
+    double start = platform_now();
+    write_frame(staging[index]);
+    write_time += platform_now() - start;
+
+    {
+      std::lock_guard<std::mutex> lock(staging_mutex);
+      staging[index].full = false;
+    }
+    staging_changed.notify_all();
+  }
+}
+
+static bool start()
+{
+  started = true;
+  width = SCREEN_WIDTH;
+  height = SCREEN_HEIGHT;
+
+  if (to_pipe)
+    stream = popen(target.c_str() + 1, PIPE_WRITE_MODE);
+  else if (!per_frame_files)
+    stream = fopen(target.c_str(), "wb");
+  if (!per_frame_files && !stream)
+  {
+    failed = true;
+    return false;
+  }
+
+  for (int i = 0; i < CAPTURE_STAGING; i++)
+  {
+    staging[i].pixels.resize(size_t(width) * height);
+    staging[i].full = false;
+  }
+  writer = std::thread(writer_proc);
+  return true;
+}
+
+void engine_capture_frame(const uint32_t* pixels, int stride)
+{
+  if (target.empty() || presented_frames++ % interval != 0)
+    return;
+  if (!started && !start())
+    return;
+  if (failed)
+    return;
+
+  ProfileScope profile(PROFILE_CAPTURE);
+  double begin = platform_now();
+
+  CaptureStaging& frame = staging[next_staging];
+  {
+    std::unique_lock<std::mutex> lock(staging_mutex);
+    if (lossless)
+      staging_changed.wait(lock, [&frame] { return !frame.full; });
+    else if (frame.full)
+    {
+      dropped_frames++;
+      return;
+    }
+  }
+
+  for (int y = 0; y < height; y++)
+    memcpy(&frame.pixels[size_t(y) * width], pixels + ptrdiff_t(y) * stride, width * sizeof(uint32_t));
+  frame.frame = presented_frames - 1;
+  captured_frames++;
+
+  {
+    std::lock_guard<std::mutex> lock(staging_mutex);
+    frame.full = true;
+  }
+  staging_changed.notify_all();
+  next_staging = (next_staging + 1) % CAPTURE_STAGING;
+
+  double elapsed = platform_now() - begin;
+  copy_time += elapsed;
+  if (elapsed > copy_time_max)
+    copy_time_max = elapsed;
+}
+
+void engine_capture_stop()
+{
+  if (!started)
+    return;
+
+  // the writer drains what is staged before it sees stopping
+  {
+    std::lock_guard<std::mutex> lock(staging_mutex);
+    stopping = true;
+  }
+  staging_changed.notify_all();
+  if (writer.joinable())
+    writer.join();
+
+  if (stream)
+  {
+    if (to_pipe)
+      pclose(stream);
+    else
+      fclose(stream);
+  }
+  stream = NULL;
+  started = false;
+}
+
+void engine_print_capture_report(void (*print)(const char* line))
+{
+  if (target.empty())
+    return;
+
+  char line[512];
+  snprintf(line, sizeof(line),
+    "capture: %s%s, %llu frames, %llu dropped, %.1f MB, copy avg %.3f ms, max %.3f ms, write avg %.3f ms",
+    target.c_str(), failed.load() ? " (write failed)" : "", (unsigned long long)captured_frames,
+    (unsigned long long)dropped_frames, written_bytes / (1024.0 * 1024.0),
+    captured_frames ? copy_time / captured_frames * 1000.0 : 0.0, copy_time_max * 1000.0,
+    captured_frames ? write_time / captured_frames * 1000.0 : 0.0);
+  print(line);
+}
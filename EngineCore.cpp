@@ -0,0 +1,330 @@
+/* MIT License
+ * 
+ * Copyright (c) 2024 Dmitry Shapovalov
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#include "EngineCore.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+
+static std::atomic<bool> quited(false);
+
+static float tick_rate = 0.0f;
+static int max_catch_up_steps = 5;
+
+// replays set the seed and the resolution themselves and record nothing, so these options
+// are refused along with --replay, whatever their order
+static bool seed_option = false;
+static bool record_option = false;
+static bool resolution_option = false;
+
+static Broadphase broadphase = BROADPHASE_TREE;
+static const char* broadphase_names[BROADPHASE_COUNT] = { "brute", "grid", "sweep", "tree" };
+
+static double ref_time = 0.0;
+static double accumulator = 0.0;
+static float render_alpha = 1.0f;
+
+void schedule_quit_game()
+{
+  quited = true;
+}
+
+bool engine_is_quit_scheduled()
+{
+  return quited;
+}
+
+void set_fixed_timestep(float ticks_per_second, int max_steps)
+{
+  tick_rate = ticks_per_second > 0.0f ? ticks_per_second : 0.0f;
+  max_catch_up_steps = max_steps > 0 ? max_steps : 1;
+  accumulator = 0.0;
+  render_alpha = 1.0f;
+}
+
+float get_render_alpha()
+{
+  return render_alpha;
+}
+
+float engine_tick_rate()
+{
+  return tick_rate;
+}
+
+static void run_tick(float dt)
+{
+  {
+    ProfileScope profile(PROFILE_INPUT);
+    engine_take_input_snapshot(platform_now());
+  }
+  engine_record_tick(dt, get_input_snapshot());
+  act(dt);
+}
+
+Broadphase get_broadphase()
+{
+  return broadphase;
+}
+
+bool engine_set_broadphase(const char* name)
+{
+  for (int i = 0; i < BROADPHASE_COUNT; i++)
+  {
+    if (strcmp(name, broadphase_names[i]) == 0)
+    {
+      broadphase = Broadphase(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+int engine_parse_option(int argc, char** argv, int i)
+{
+  if (strcmp(argv[i], "--pipeline") == 0)
+  {
+    engine_set_pipelined(true);
+    return 1;
+  }
+  if (strcmp(argv[i], "--full-redraw") == 0)
+  {
+    engine_set_dirty_rects(false);
+    return 1;
+  }
+  if (strcmp(argv[i], "--indexed") == 0)
+  {
+    engine_set_indexed(true);
+    return 1;
+  }
+  if (strcmp(argv[i], "--vsync") == 0)
+  {
+    set_frame_pacing(FRAME_PACING_VSYNC, 0.0f);
+    return 1;
+  }
+
+  if (i + 1 >= argc)
+    return 0;
+
+  if (strcmp(argv[i], "--fps") == 0)
+  {
+    float fps = float(atof(argv[i + 1]));
+    set_frame_pacing(fps > 0.0f ? FRAME_PACING_TARGET_FPS : FRAME_PACING_UNLIMITED, fps);
+    return 2;
+  }
+  if (strcmp(argv[i], "--seed") == 0)
+  {
+    if (engine_is_replaying())
+    {
+      fprintf(stderr, "--seed can't be used with --replay\n");
+      return 0;
+    }
+    seed_option = true;
+    engine_set_random_seed(unsigned(strtoul(argv[i + 1], NULL, 0)));
+    return 2;
+  }
+  if (strcmp(argv[i], "--record") == 0)
+  {
+    if (engine_is_replaying())
+    {
+      fprintf(stderr, "--record can't be used with --replay\n");
+      return 0;
+    }
+    if (!engine_record_open(argv[i + 1]))
+    {
+      fprintf(stderr, "can't create '%s'\n", argv[i + 1]);
+      return 0;
+    }
+    record_option = true;
+    return 2;
+  }
+  if (strcmp(argv[i], "--replay") == 0)
+  {
+    if (seed_option || record_option || resolution_option)
+    {
+      fprintf(stderr, "%s can't be used with --replay\n",
+        seed_option ? "--seed" : record_option ? "--record" : "--resolution");
+      return 0;
+    }
+    if (!engine_replay_open(argv[i + 1]))
+    {
+      fprintf(stderr, "can't replay '%s'\n", argv[i + 1]);
+      return 0;
+    }
+    return 2;
+  }
+  if (strcmp(argv[i], "--resolution") == 0)
+  {
+    int width = 0;
+    int height = 0;
+    if (engine_is_replaying())
+    {
+      fprintf(stderr, "--resolution can't be used with --replay\n");
+      return 0;
+    }
+    if (sscanf(argv[i + 1], "%dx%d", &width, &height) != 2 || !engine_set_resolution(width, height))
+    {
+      fprintf(stderr, "bad resolution '%s'\n", argv[i + 1]);
+      return 0;
+    }
+    resolution_option = true;
+    return 2;
+  }
+  if (strcmp(argv[i], "--capture") == 0)
+  {
+    if (!engine_set_capture(argv[i + 1]))
+      return 0;
+    return 2;
+  }
+  if (strcmp(argv[i], "--capture-every") == 0)
+  {
+    engine_set_capture_interval(atoi(argv[i + 1]));
+    return 2;
+  }
+  if (strcmp(argv[i], "--simd") == 0)
+  {
+    if (!engine_set_raster_isa(argv[i + 1]))
+      return 0;
+    return 2;
+  }
+  if (strcmp(argv[i], "--shape-cache") == 0)
+  {
+    engine_set_shape_cache_size(atoi(argv[i + 1]));
+    return 2;
+  }
+  if (strcmp(argv[i], "--render-threads") == 0)
+  {
+    engine_set_render_threads(atoi(argv[i + 1]));
+    return 2;
+  }
+  if (strcmp(argv[i], "--broadphase") == 0)
+  {
+    if (!engine_set_broadphase(argv[i + 1]))
+    {
+      fprintf(stderr, "unknown broadphase '%s'\n", argv[i + 1]);
+      return 0;
+    }
+    return 2;
+  }
+  if (strcmp(argv[i], "--profile") == 0)
+  {
+    engine_set_profile_csv(argv[i + 1]);
+    return 2;
+  }
+  if (strcmp(argv[i], "--input-rate") == 0)
+  {
+    engine_set_input_sample_rate(atof(argv[i + 1]));
+    return 2;
+  }
+  if (strcmp(argv[i], "--tick-rate") == 0)
+  {
+    set_fixed_timestep(float(atof(argv[i + 1])), max_catch_up_steps);
+    return 2;
+  }
+  if (strcmp(argv[i], "--max-steps") == 0)
+  {
+    set_fixed_timestep(tick_rate, atoi(argv[i + 1]));
+    return 2;
+  }
+  return 0;
+}
+
+const char* engine_options_usage()
+{
+  return "[--tick-rate HZ] [--max-steps N] [--fps N | --vsync] [--pipeline] [--input-rate HZ]"
+    " [--seed N] [--record FILE | --replay FILE] [--profile FILE] [--resolution WxH] [--simd ISA] [--shape-cache N] [--render-threads N] [--full-redraw] [--indexed]"
+    " [--broadphase NAME]"
+    " [--capture TARGET] [--capture-every N]";
+}
+
+void engine_start(double now)
+{
+  ref_time = now;
+  accumulator = 0.0;
+}
+
+void engine_shutdown(void (*print)(const char* line))
+{
+  engine_record_close();
+  engine_capture_stop();
+  engine_render_threads_stop();
+  engine_print_pacing_report(print);
+  engine_print_input_report(print);
+  engine_print_raster_report(print);
+  engine_print_shape_cache_report(print);
+  engine_print_tiles_report(print);
+  engine_print_dirty_report(print);
+  engine_print_capture_report(print);
+  engine_print_profile_report(print);
+}
+
+bool engine_simulate(double now)
+{
+  if (quited)
+    return false;
+
+  double elapsed = now - ref_time;
+  ref_time = now;
+
+  if (tick_rate <= 0.0f)
+  {
+    float dt = float(elapsed);
+    if (dt > 0.1f)
+      dt = 0.1f;
+
+    run_tick(dt);
+  }
+  else
+  {
+    const double step = 1.0 / tick_rate;
+
+    accumulator += elapsed;
+    for (int i = 0; accumulator >= step && !quited; i++)
+    {
+      if (i == max_catch_up_steps)
+      {
+        // too slow to keep up: drop whole ticks, keep the phase for interpolation
+        accumulator = fmod(accumulator, step);
+        break;
+      }
+      run_tick(float(step));
+      accumulator -= step;
+    }
+    render_alpha = float(accumulator / step);
+  }
+
+  return !quited;
+}
+
+bool engine_frame(double now)
+{
+  if (!engine_simulate(now))
+    return false;
+
+  ProfileScope profile(PROFILE_DRAW);
+  draw();
+  engine_flush_draws();
+  return true;
+}
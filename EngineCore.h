@@ -0,0 +1,224 @@
+/* MIT License
+ * 
+ * Copyright (c) 2024 Dmitry Shapovalov
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+#pragma once
+
+// engine internals shared by the platform backends (Engine.cpp, EngineHeadless.cpp),
+// game code uses Engine.h only
+
+#include "Engine.h"
+
+// command line options common to all backends:
+//   --tick-rate HZ   - fixed timestep, act() is called HZ times per second (0 - variable dt)
+//   --max-steps N    - fixed timestep: max act() calls per frame before time is dropped
+//   --fps N          - frame pacing: N frames per second, 0 - unlimited
+//   --vsync          - frame pacing: display refresh rate
+//   --pipeline       - simulate, draw and present on separate threads (see capture_frame())
+//   --input-rate HZ  - how often the input thread samples the devices (default 1000)
+//   --seed N         - get_random_seed() value
+//   --record FILE    - write the seed and the input of every act() to FILE
+//   --resolution WxH - framebuffer size (default 1024x768)
+//   --simd ISA       - span fill implementation: scalar, sse2, avx2 (default: the best available)
+//   --shape-cache N  - pre-rasterized shapes to keep (default SHAPE_CACHE_DEFAULT_SIZE, 0 - off)
+//   --render-threads N - threads rasterizing the tiles (default one per core, 1 - no tiles)
+//   --broadphase NAME - collision broadphase: brute, grid, sweep, tree (default tree)
+//   --full-redraw    - clear and present the whole frame, ignore the dirty rectangles
+//   --indexed        - 8-bit palette framebuffer, expanded to 32 bits when presented
+//   --capture TARGET - stream frames to files, one file or a pipe (see EngineCapture.cpp)
+//   --capture-every N - capture every Nth presented frame (default 1)
+//   --profile FILE   - write the per-phase timings of the last frames to FILE (CSV) on exit
+//   --replay FILE    - instead of playing, run the recorded ticks from FILE at full speed, no window,
+//                      with the recorded seed and resolution (not with --seed, --record, --resolution)
+//
+// returns the number of arguments consumed at argv[i], 0 if argv[i] is not an engine option
+int engine_parse_option(int argc, char** argv, int i);
+const char* engine_options_usage();
+
+// get_broadphase() value by name, false if there is no such broadphase
+bool engine_set_broadphase(const char* name);
+
+// sets the clock reference, call right before the first engine_frame()
+void engine_start(double now);
+
+// prints the reports, closes the recording; call after finalize()
+void engine_shutdown(void (*print)(const char* line));
+
+// runs act() for the time passed since the previous frame, then draw();
+// returns false if the game scheduled quit (nothing was drawn, nothing to present)
+bool engine_frame(double now);
+
+// engine_frame() without draw(), returns false if the game scheduled quit
+bool engine_simulate(double now);
+
+bool engine_is_quit_scheduled();
+float engine_tick_rate();
+
+// frame pacing: waits for the next deadline (OS sleep, then spin for the last part),
+// call once per frame after presenting, engine_pacing_start() right before the first frame
+void engine_pacing_start();
+void engine_wait_next_frame();
+void engine_print_pacing_report(void (*print)(const char* line));
+
+// profiling (EngineProfile.cpp): closes the frame, frame_time is its total without pacing waits
+void engine_profile_end_frame(double frame_time);
+void engine_set_profile_csv(const char* path);
+void engine_print_profile_report(void (*print)(const char* line));
+
+// dirty rectangles (EngineDirty.cpp)
+#define DIRTY_MAX_RECTS 64
+
+struct DirtyRect {
+  int left;
+  int top;
+  int right;
+  int bottom;
+};
+
+struct DirtyRegion {
+  int count;
+  int area;   // sum of the rectangles
+  bool full;  // the whole screen, rects are not used
+  DirtyRect rects[DIRTY_MAX_RECTS];
+};
+
+void engine_set_dirty_rects(bool enable);
+// what has to be presented to show the frame drawn into slot, call once per presented frame
+void engine_take_present_region(int slot, DirtyRegion* region);
+void engine_print_dirty_report(void (*print)(const char* line));
+
+// frame capture (EngineCapture.cpp)
+bool engine_set_capture(const char* target);
+void engine_set_capture_interval(int frames);
+// wait for the writer instead of dropping frames
+void engine_set_capture_lossless(bool enable);
+// call once per presented frame, copies it if it is to be captured
+void engine_capture_frame(const uint32_t* pixels, int stride);
+// writes out what is staged and closes the target
+void engine_capture_stop();
+void engine_print_capture_report(void (*print)(const char* line));
+
+// span fill (EngineRaster.cpp)
+enum RasterIsa {
+  RASTER_ISA_SCALAR,
+  RASTER_ISA_SSE2,
+  RASTER_ISA_AVX2
+};
+
+// picks the implementation by name, capped at what the CPU supports
+bool engine_set_raster_isa(const char* name);
+void engine_print_raster_report(void (*print)(const char* line));
+// palette index of a color (added on first use; past 256 colors the nearest one)
+uint8_t palette_index(uint32_t color);
+// dst[i] = color of palette index src[i]
+void expand_indices(uint32_t* dst, const uint8_t* src, int count);
+
+// shape cache (EngineShapeCache.cpp)
+void engine_set_shape_cache_size(int entries);
+// evicts what is over the size, call when no draw call is running
+void engine_trim_shape_cache();
+void engine_print_shape_cache_report(void (*print)(const char* line));
+
+// tile renderer (EngineTiles.cpp)
+void engine_set_render_threads(int count);
+// renders the submitted draw calls into buffer, call after draw() / draw_frame()
+void engine_flush_draws();
+void engine_render_threads_stop();
+void engine_print_tiles_report(void (*print)(const char* line));
+
+// pipelined mode
+void engine_set_pipelined(bool enable);
+bool engine_is_pipelined();
+// starts the simulation thread (initialize(), then act() and capture_frame() every frame) and the
+// render thread (draw_frame()); clock() gives the simulation time, before_frame(n) runs on the
+// simulation thread ahead of frame n and may be NULL
+void engine_pipeline_start(double (*clock)(), void (*before_frame)(uint64_t frame));
+// waits for the next frame in order to be rendered, returns its slot or -1 on timeout/quit;
+// the slot's backbuffer is not touched until engine_pipeline_release()
+int engine_pipeline_acquire(double timeout);
+void engine_pipeline_release(int slot);
+// schedules quit and joins the threads, finalize() is left to the caller
+void engine_pipeline_stop();
+// 32-bit pixels of the slot's frame to present (indexed mode: the last frame expanded by
+// engine_take_present_region(), shared by all the slots)
+uint32_t* engine_backbuffer(int slot);
+// framebuffer size, only before engine_create_backbuffers(); false if out of the supported range
+bool engine_set_resolution(int width, int height);
+// allocates the backbuffers, call once after the options are parsed and before initialize()
+void engine_create_backbuffers();
+// slot of the backbuffer buffer points to (always 0 unless pipelined)
+int engine_buffer_slot();
+// the background layer clear_buffer() restores (same size, stride and format as the backbuffers)
+void* engine_background();
+// what buffer draws into: buffer.pixels, or buffer.indices in indexed mode
+void* engine_buffer_data();
+void engine_set_buffer_data(void* data);
+
+// indexed mode (--indexed): backbuffers hold 1-byte palette indices, fill_pixels() turns colors into
+// indices and presented regions are expanded to 32 bits; only before engine_create_backbuffers()
+bool engine_set_indexed(bool enable);
+bool engine_is_indexed();
+// bytes per backbuffer pixel
+int engine_pixel_size();
+// expands the region of the slot's indices to the frame engine_backbuffer() returns
+void engine_expand_backbuffer(int slot, const DirtyRegion& region);
+
+// input (EngineInput.cpp): one producer thread pushes events, the simulation consumes them
+struct InputEvent {
+  enum Type : uint8_t { KEY, MOUSE_BUTTON, CURSOR, WINDOW_ACTIVE };
+
+  double time;    // platform_now() when sampled
+  Type type;
+  uint8_t code;   // VK code or mouse button
+  bool pressed;   // KEY, MOUSE_BUTTON, WINDOW_ACTIVE
+  int32_t x;      // CURSOR
+  int32_t y;
+};
+
+// returns false if the ring is full, the event should be pushed again later
+bool engine_push_input(const InputEvent& event);
+// folds pushed events into the snapshot read by is_key_pressed() etc., called before every act()
+void engine_take_input_snapshot(double now);
+// keys is_key_pressed() was asked about, the others need not be sampled
+bool engine_is_key_watched(int button_vk_code);
+// replaces the snapshot, for replays
+void engine_set_input_snapshot(const InputSnapshot& input);
+// calls sample(now) from a dedicated thread at the input rate, sample() is the only producer then
+void engine_set_input_sample_rate(double rate);
+void engine_input_thread_start(void (*sample)(double now));
+void engine_input_thread_stop();
+void engine_print_input_report(void (*print)(const char* line));
+
+// recording and replay (EngineReplay.cpp)
+void engine_set_random_seed(unsigned seed);
+bool engine_record_open(const char* path);
+void engine_record_tick(float dt, const InputSnapshot& input);
+void engine_record_close();
+bool engine_replay_open(const char* path);
+bool engine_is_replaying();
+// initialize(), act() + draw() for every recorded tick, finalize()
+void engine_run_replay(void (*print)(const char* line));
+
+// implemented by the backend
+double platform_now();                // monotonic, seconds
+void platform_sleep(double seconds);  // coarse, may oversleep by the timer resolution
+float platform_refresh_rate();        // display refresh rate, 0 if unknown
@@ -0,0 +1,235 @@
+/* MIT License
+ * 
+ * Copyright (c) 2024 Dmitry Shapovalov
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+// dirty rectangles: shapes report the pixels they draw with add_dirty_rect(), every backbuffer
+// remembers what was drawn into it, so clear_buffer() erases only that and the backend presents
+// only what differs from the previously presented frame (drawn there or drawn now); a region
+// that covers too much of the screen falls back to the whole frame; cleared pixels are restored
+// from the background layer, a new layer is copied whole into every backbuffer once
+
+#include "EngineCore.h"
+#include <stdio.h>
+#include <string.h>
+
+// above this share of the screen the whole frame is cleared / presented
+#define DIRTY_FULL_COVERAGE 0.5
+
+static bool dirty_rects_enabled = true;
+
+static DirtyRegion drawn[PIPELINE_DEPTH];
+static DirtyRegion presented;
+static bool presented_valid = false; // nothing is on the screen yet
+
+static void* frame_data = NULL;  // engine_buffer_data() while the background is drawn
+static uint64_t background_version = 0;  // 0 - black
+static uint64_t slot_background[PIPELINE_DEPTH] = { 0 };
+
+static uint64_t present_count = 0;
+static uint64_t present_full = 0;
+static double present_coverage = 0.0;
+
+static int area(const DirtyRect& rect)
+{
+  return (rect.right - rect.left) * (rect.bottom - rect.top);
+}
+
+static void region_reset(DirtyRegion& region, bool full)
+{
+  region.count = 0;
+  region.area = 0;
+  region.full = full;
+}
+
+static DirtyRect bounds(const DirtyRect& a, const DirtyRect& b)
+{
+  DirtyRect rect = {
+    a.left < b.left ? a.left : b.left,
+    a.top < b.top ? a.top : b.top,
+    a.right > b.right ? a.right : b.right,
+    a.bottom > b.bottom ? a.bottom : b.bottom
+  };
+  return rect;
+}
+
+// a rectangle is merged into an existing one when their bounds cost no more than both apart
+// (overlapping shapes of one body), so distant or thin ones (borders) stay separate; when the
+// list is full it is merged into the one whose bounds grow least
+static void region_add(DirtyRegion& region, DirtyRect rect)
+{
+  if (region.full)
+    return;
+
+  if (rect.left < 0)
+    rect.left = 0;
+  if (rect.top < 0)
+    rect.top = 0;
+  if (rect.right > SCREEN_WIDTH)
+    rect.right = SCREEN_WIDTH;
+  if (rect.bottom > SCREEN_HEIGHT)
+    rect.bottom = SCREEN_HEIGHT;
+  if (rect.left >= rect.right || rect.top >= rect.bottom)
+    return;
+
+  int best = -1;
+  int best_growth = 0;
+  for (int i = 0; i < region.count; i++)
+  {
+    const DirtyRect& other = region.rects[i];
+    int growth = area(bounds(rect, other)) - area(other);
+    if (growth <= area(rect) && (best < 0 || growth < best_growth))
+    {
+      best = i;
+      best_growth = growth;
+      if (growth == 0)
+        break;
+    }
+  }
+
+  if (best < 0 && region.count == DIRTY_MAX_RECTS)
+  {
+    for (int i = 0; i < region.count; i++)
+    {
+      int growth = area(bounds(rect, region.rects[i])) - area(region.rects[i]);
+      if (best < 0 || growth < best_growth)
+      {
+        best = i;
+        best_growth = growth;
+      }
+    }
+  }
+
+  if (best >= 0)
+  {
+    region.rects[best] = bounds(rect, region.rects[best]);
+    region.area += best_growth;
+  }
+  else
+  {
+    region.rects[region.count++] = rect;
+    region.area += area(rect);
+  }
+
+  if (region.area > DIRTY_FULL_COVERAGE * SCREEN_WIDTH * SCREEN_HEIGHT)
+    region_reset(region, true);
+}
+
+void add_dirty_rect(int left, int top, int right, int bottom)
+{
+  if (frame_data)
+    return;
+
+  DirtyRect rect = { left, top, right, bottom };
+  region_add(drawn[engine_buffer_slot()], rect);
+}
+
+void clear_buffer()
+{
+  const int slot = engine_buffer_slot();
+  DirtyRegion& region = drawn[slot];
+
+  // a changed layer is copied whole and the frame is presented whole
+  const bool new_background = slot_background[slot] != background_version;
+  slot_background[slot] = background_version;
+
+  // in bytes, the same for both pixel formats
+  const size_t pixel_size = engine_pixel_size();
+  char* pixels = (char*)engine_buffer_data();
+  const char* layer = background_version ? (const char*)engine_background() : NULL;
+  if (region.full || new_background)
+  {
+    const size_t size = size_t(buffer.height) * buffer.stride * pixel_size;
+    if (layer)
+      memcpy(pixels, layer, size);
+    else
+      memset(pixels, 0, size);
+  }
+  else
+  {
+    for (int i = 0; i < region.count; i++)
+    {
+      const DirtyRect& rect = region.rects[i];
+      const size_t size = (rect.right - rect.left) * pixel_size;
+      for (int y = rect.top; y < rect.bottom; y++)
+      {
+        const size_t offset = (size_t(y) * buffer.stride + rect.left) * pixel_size;
+        if (layer)
+          memcpy(pixels + offset, layer + offset, size);
+        else
+          memset(pixels + offset, 0, size);
+      }
+    }
+  }
+
+  region_reset(region, !dirty_rects_enabled || new_background);
+}
+
+void begin_background()
+{
+  frame_data = engine_buffer_data();
+  engine_set_buffer_data(engine_background());
+  memset(engine_background(), 0, size_t(buffer.height) * buffer.stride * engine_pixel_size());
+}
+
+void end_background()
+{
+  engine_flush_draws();
+  engine_set_buffer_data(frame_data);
+  frame_data = NULL;
+  background_version++;
+}
+
+void engine_set_dirty_rects(bool enable)
+{
+  dirty_rects_enabled = enable;
+  for (int i = 0; i < PIPELINE_DEPTH; i++)
+    region_reset(drawn[i], true);
+}
+
+void engine_take_present_region(int slot, DirtyRegion* region)
+{
+  const DirtyRegion& frame = drawn[slot];
+
+  region_reset(*region, !presented_valid || frame.full || presented.full);
+  for (int i = 0; i < presented.count; i++)
+    region_add(*region, presented.rects[i]);
+  for (int i = 0; i < frame.count; i++)
+    region_add(*region, frame.rects[i]);
+
+  presented = frame;
+  presented_valid = true;
+  engine_expand_backbuffer(slot, *region);
+
+  present_count++;
+  if (region->full)
+    present_full++;
+  present_coverage += region->full ? 1.0 : double(region->area) / (SCREEN_WIDTH * SCREEN_HEIGHT);
+}
+
+void engine_print_dirty_report(void (*print)(const char* line))
+{
+  char line[256];
+  snprintf(line, sizeof(line), "dirty rects: %s, %llu presents, %llu full, avg %.1f%% of the screen, %llu background layers",
+    dirty_rects_enabled ? "on" : "off", (unsigned long long)present_count, (unsigned long long)present_full,
+    present_count ? 100.0 * present_coverage / present_count : 0.0, (unsigned long long)background_version);
+  print(line);
+}
@@ -0,0 +1,307 @@
+/* MIT License
+ * 
+ * Copyright (c) 2024 Dmitry Shapovalov
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+// Offscreen backend: no window, the backbuffer is never presented.
+// Input comes from headless_set_*() or from a script file (pushed as input events from the calling
+// thread, there is no sampling thread), time from a monotonic clock.
+//
+//  usage: game [--frames N] [--input script.txt] [--dt seconds] [engine options, see EngineCore.h]
+//
+//    --frames N  - stop after N frames (default: run until schedule_quit_game())
+//    --input     - scripted input, one event per line, '#' starts a comment:
+//                    <frame> key <VK name | 'A'..'Z' | code> <0|1>
+//                    <frame> mouse <0|1> <0|1>
+//                    <frame> cursor <x> <y>
+//    --dt        - advance a virtual clock by a constant step per frame instead of reading the real one
+
+#include "EngineCore.h"
+
+#ifdef ENGINE_HEADLESS
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+struct ScriptEvent
+{
+  enum Type { KEY, MOUSE, CURSOR };
+
+  uint64_t frame;
+  Type type;
+  int a;
+  int b;
+};
+
+static std::vector<ScriptEvent> script;
+static size_t script_pos = 0;
+
+static double fixed_dt = 0.0;
+static uint64_t virtual_ticks = 0;
+
+double platform_now()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void platform_sleep(double seconds)
+{
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+}
+
+float platform_refresh_rate()
+{
+  return 0.0f;
+}
+
+static double virtual_clock()
+{
+  return double(virtual_ticks++) * fixed_dt;
+}
+
+static void print_line(const char* line)
+{
+  printf("%s\n", line);
+}
+
+void headless_set_key_state(int button_vk_code, bool pressed)
+{
+  if (button_vk_code >= 0 && button_vk_code < 256)
+  {
+    InputEvent event = { platform_now(), InputEvent::KEY, uint8_t(button_vk_code), pressed };
+    engine_push_input(event);
+  }
+}
+
+void headless_set_mouse_button_state(int button, bool pressed)
+{
+  if (button >= 0 && button < 2)
+  {
+    InputEvent event = { platform_now(), InputEvent::MOUSE_BUTTON, uint8_t(button), pressed };
+    engine_push_input(event);
+  }
+}
+
+void headless_set_cursor_pos(int x, int y)
+{
+  InputEvent event = { platform_now(), InputEvent::CURSOR, 0, false, x, y };
+  engine_push_input(event);
+}
+
+static int parse_key(const char* name)
+{
+  static const struct { const char* name; int code; } names[] = {
+    { "ESCAPE", VK_ESCAPE }, { "SPACE", VK_SPACE }, { "LEFT", VK_LEFT }, { "UP", VK_UP },
+    { "RIGHT", VK_RIGHT }, { "DOWN", VK_DOWN }, { "RETURN", VK_RETURN }
+  };
+
+  for (auto& n : names)
+    if (strcmp(n.name, name) == 0)
+      return n.code;
+
+  if (name[0] != 0 && name[1] == 0)
+    return (unsigned char)name[0];
+
+  char* end = nullptr;
+  long code = strtol(name, &end, 0);
+  return (*end == 0 && code >= 0 && code < 256) ? int(code) : -1;
+}
+
+static bool load_script(const char* path)
+{
+  FILE* f = fopen(path, "r");
+  if (!f)
+  {
+    fprintf(stderr, "can't open input script '%s'\n", path);
+    return false;
+  }
+
+  char line[256];
+  int line_no = 0;
+  while (fgets(line, sizeof(line), f))
+  {
+    line_no++;
+    char* comment = strchr(line, '#');
+    if (comment)
+      *comment = 0;
+
+    unsigned long long frame;
+    char type[16];
+    char arg[32];
+    int value = 0;
+    int n = sscanf(line, "%llu %15s %31s %d", &frame, type, arg, &value);
+    if (n <= 0)
+      continue;
+
+    // cursor coordinates may be negative (outside the window), so validity is kept apart from ev.a
+    ScriptEvent ev = { frame, ScriptEvent::KEY, -1, value };
+    bool ok = false;
+    if (n == 4 && strcmp(type, "key") == 0)
+    {
+      ev.a = parse_key(arg);
+      ok = ev.a >= 0;
+    }
+    else if (n == 4 && strcmp(type, "mouse") == 0)
+    {
+      ev.type = ScriptEvent::MOUSE;
+      ev.a = atoi(arg);
+      ok = ev.a >= 0;
+    }
+    else if (n == 4 && strcmp(type, "cursor") == 0)
+    {
+      ev.type = ScriptEvent::CURSOR;
+      ev.a = atoi(arg);
+      ok = true;
+    }
+
+    if (!ok)
+    {
+      fprintf(stderr, "%s:%d: bad input event\n", path, line_no);
+      fclose(f);
+      return false;
+    }
+    script.push_back(ev);
+  }
+  fclose(f);
+
+  std::stable_sort(script.begin(), script.end(),
+    [](const ScriptEvent& l, const ScriptEvent& r) { return l.frame < r.frame; });
+  return true;
+}
+
+static void apply_script(uint64_t frame)
+{
+  for (; script_pos < script.size() && script[script_pos].frame <= frame; script_pos++)
+  {
+    const ScriptEvent& ev = script[script_pos];
+    switch (ev.type)
+    {
+    case ScriptEvent::KEY:
+      headless_set_key_state(ev.a, ev.b != 0);
+      break;
+    case ScriptEvent::MOUSE:
+      headless_set_mouse_button_state(ev.a, ev.b != 0);
+      break;
+    case ScriptEvent::CURSOR:
+      headless_set_cursor_pos(ev.a, ev.b);
+      break;
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  uint64_t max_frames = 0;
+
+  for (int i = 1; i < argc; i++)
+  {
+    int used = engine_parse_option(argc, argv, i);
+    if (used)
+      i += used - 1;
+    else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+      max_frames = strtoull(argv[++i], nullptr, 10);
+    else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc)
+    {
+      if (!load_script(argv[++i]))
+        return 1;
+    }
+    else if (strcmp(argv[i], "--dt") == 0 && i + 1 < argc)
+      fixed_dt = atof(argv[++i]);
+    else
+    {
+      fprintf(stderr, "usage: %s [--frames N] [--input script.txt] [--dt seconds] %s\n",
+        argv[0], engine_options_usage());
+      return 1;
+    }
+  }
+
+  engine_create_backbuffers();
+
+  if (engine_is_replaying())
+  {
+    engine_run_replay(print_line);
+    return 0;
+  }
+
+  double (*clock)() = fixed_dt > 0.0 ? virtual_clock : platform_now;
+  uint64_t frame = 0;
+  double start_time = platform_now();
+
+  if (engine_is_pipelined())
+  {
+    engine_pipeline_start(clock, apply_script);
+    engine_pacing_start();
+    while (!engine_is_quit_scheduled())
+    {
+      int slot = engine_pipeline_acquire(0.1);
+      if (slot < 0)
+        continue;
+
+      DirtyRegion region;
+      engine_take_present_region(slot, &region);
+      engine_capture_frame(engine_backbuffer(slot), buffer.stride);
+      engine_pipeline_release(slot);
+      engine_wait_next_frame();
+
+      frame++;
+      if (max_frames && frame >= max_frames)
+        schedule_quit_game();
+    }
+    engine_pipeline_stop();
+  }
+  else
+  {
+    initialize();
+    engine_start(clock());
+    engine_pacing_start();
+    while (!engine_is_quit_scheduled())
+    {
+      apply_script(frame);
+
+      if (engine_frame(clock()))
+      {
+        DirtyRegion region;
+        engine_take_present_region(0, &region);
+        engine_capture_frame(engine_backbuffer(0), buffer.stride);
+      }
+      engine_wait_next_frame();
+
+      frame++;
+      if (max_frames && frame >= max_frames)
+        schedule_quit_game();
+    }
+  }
+
+  double elapsed = platform_now() - start_time;
+  finalize();
+
+  printf("frames: %llu, time: %.3f s, fps: %.1f\n",
+    (unsigned long long)frame, elapsed, elapsed > 0.0 ? frame / elapsed : 0.0);
+  engine_shutdown(print_line);
+  return 0;
+}
+
+#endif // ENGINE_HEADLESS
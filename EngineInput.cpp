@@ -0,0 +1,201 @@
+/* MIT License
+ * 
+ * Copyright (c) 2024 Dmitry Shapovalov
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+// input: the backend produces timestamped events (from its sampling thread or injected), they go
+// through a single-producer/single-consumer lock-free ring to the simulation, which folds them into
+// one immutable InputSnapshot before every act(); is_key_pressed() etc. read only that snapshot
+
+#include "EngineCore.h"
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+
+#define INPUT_RING_SIZE 1024
+
+static InputEvent ring[INPUT_RING_SIZE];
+static std::atomic<uint32_t> ring_head(0); // next write, owned by the producer
+static std::atomic<uint32_t> ring_tail(0); // next read, owned by the consumer
+
+static InputSnapshot snapshot = { { 0 }, { false, false }, 0, 0, true };
+
+// keys the game asked about, the sampler polls only those
+static std::atomic<uint32_t> watched_keys[8];
+
+static std::thread input_thread;
+static std::atomic<bool> input_thread_running(false);
+static double sample_rate = 1000.0;
+
+static uint64_t latency_events = 0;
+static double latency_sum = 0.0;
+static double latency_max = 0.0;
+
+bool engine_push_input(const InputEvent& event)
+{
+  const uint32_t head = ring_head.load(std::memory_order_relaxed);
+  if (head - ring_tail.load(std::memory_order_acquire) == INPUT_RING_SIZE)
+    return false;
+
+  ring[head % INPUT_RING_SIZE] = event;
+  ring_head.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+void engine_take_input_snapshot(double now)
+{
+  InputSnapshot next = snapshot;
+  next.time = now;
+  next.events = 0;
+  next.oldest_event_time = 0.0;
+
+  const uint32_t head = ring_head.load(std::memory_order_acquire);
+  uint32_t tail = ring_tail.load(std::memory_order_relaxed);
+  for (; tail != head; tail++)
+  {
+    const InputEvent& event = ring[tail % INPUT_RING_SIZE];
+    switch (event.type)
+    {
+    case InputEvent::KEY:
+      if (event.pressed)
+        next.keys[event.code >> 5] |= 1u << (event.code & 31);
+      else
+        next.keys[event.code >> 5] &= ~(1u << (event.code & 31));
+      break;
+    case InputEvent::MOUSE_BUTTON:
+      if (event.code < 2)
+        next.mouse_buttons[event.code] = event.pressed;
+      break;
+    case InputEvent::CURSOR:
+      next.cursor_x = event.x;
+      next.cursor_y = event.y;
+      break;
+    case InputEvent::WINDOW_ACTIVE:
+      next.window_active = event.pressed;
+      break;
+    }
+
+    if (next.events++ == 0)
+      next.oldest_event_time = event.time;
+
+    double latency = now - event.time;
+    latency_events++;
+    latency_sum += latency;
+    if (latency > latency_max)
+      latency_max = latency;
+  }
+  ring_tail.store(tail, std::memory_order_release);
+
+  snapshot = next;
+}
+
+void engine_set_input_snapshot(const InputSnapshot& input)
+{
+  snapshot = input;
+}
+
+const InputSnapshot& get_input_snapshot()
+{
+  return snapshot;
+}
+
+bool engine_is_key_watched(int button_vk_code)
+{
+  return (watched_keys[button_vk_code >> 5].load(std::memory_order_relaxed) >> (button_vk_code & 31)) & 1;
+}
+
+bool is_key_pressed(int button_vk_code)
+{
+  if (button_vk_code < 0 || button_vk_code >= 256)
+    return false;
+
+  const uint32_t bit = 1u << (button_vk_code & 31);
+  std::atomic<uint32_t>& watched = watched_keys[button_vk_code >> 5];
+  if (!(watched.load(std::memory_order_relaxed) & bit))
+    watched.fetch_or(bit, std::memory_order_relaxed);
+
+  return snapshot.window_active && (snapshot.keys[button_vk_code >> 5] & bit) != 0;
+}
+
+bool is_mouse_button_pressed(int button)
+{
+  return snapshot.window_active && button >= 0 && button < 2 && snapshot.mouse_buttons[button];
+}
+
+int get_cursor_x()
+{
+  return snapshot.cursor_x;
+}
+
+int get_cursor_y()
+{
+  return snapshot.cursor_y;
+}
+
+bool is_window_active()
+{
+  return snapshot.window_active;
+}
+
+void engine_set_input_sample_rate(double rate)
+{
+  sample_rate = rate > 0.0 ? rate : 1000.0;
+}
+
+static void input_proc(void (*sample)(double now))
+{
+  const double period = 1.0 / sample_rate;
+
+  double next = platform_now();
+  while (input_thread_running.load(std::memory_order_relaxed))
+  {
+    sample(platform_now());
+
+    next += period;
+    double now = platform_now();
+    if (next > now)
+      platform_sleep(next - now);
+    else
+      next = now;
+  }
+}
+
+void engine_input_thread_start(void (*sample)(double now))
+{
+  input_thread_running = true;
+  input_thread = std::thread(input_proc, sample);
+}
+
+void engine_input_thread_stop()
+{
+  input_thread_running = false;
+  if (input_thread.joinable())
+    input_thread.join();
+}
+
+void engine_print_input_report(void (*print)(const char* line))
+{
+  char line[256];
+  snprintf(line, sizeof(line), "input: %llu events, latency avg %.3f ms, max %.3f ms",
+    (unsigned long long)latency_events,
+    latency_events ? latency_sum / latency_events * 1000.0 : 0.0, latency_max * 1000.0);
+  print(line);
+}
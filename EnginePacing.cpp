@@ -0,0 +1,149 @@
+/* MIT License
+ * 
+ * Copyright (c) 2024 Dmitry Shapovalov
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+// frame pacing: instead of spinning flat out the loop waits for the next frame deadline,
+// sleeping in the OS for most of the wait and spinning only for the last part, the sleep
+// is cut short by the measured oversleep so the deadline is not overshot
+
+#include "EngineCore.h"
+#include <stdio.h>
+
+static FramePacing mode = FRAME_PACING_UNLIMITED;
+static float requested_fps = 0.0f;
+static FramePacingState state = { FRAME_PACING_UNLIMITED };
+
+static double frame_start = 0.0;
+static double deadline = 0.0;
+static double total_frame_time = 0.0;
+static double total_wait_time = 0.0;
+
+void set_frame_pacing(FramePacing new_mode, float target_fps)
+{
+  mode = new_mode;
+  requested_fps = target_fps;
+
+  float fps = 0.0f;
+  if (mode == FRAME_PACING_TARGET_FPS)
+    fps = target_fps;
+  else if (mode == FRAME_PACING_VSYNC)
+  {
+    fps = platform_refresh_rate();
+    if (fps <= 0.0f)
+      fps = 60.0f;
+  }
+
+  if (fps <= 0.0f)
+  {
+    mode = FRAME_PACING_UNLIMITED;
+    fps = 0.0f;
+  }
+
+  state.mode = mode;
+  state.target_fps = fps;
+  if (state.sleep_overshoot <= 0.0)
+    state.sleep_overshoot = 0.001;
+  deadline = 0.0;
+}
+
+FramePacingState get_frame_pacing_state()
+{
+  return state;
+}
+
+void engine_pacing_start()
+{
+  frame_start = platform_now();
+  deadline = 0.0;
+}
+
+void engine_wait_next_frame()
+{
+  double now = platform_now();
+  state.frames++;
+  state.work_time = now - frame_start;
+  engine_profile_end_frame(state.work_time);
+  state.sleep_time = 0.0;
+  state.spin_time = 0.0;
+
+  if (state.target_fps > 0.0f)
+  {
+    const double period = 1.0 / state.target_fps;
+
+    deadline = (deadline == 0.0 ? frame_start : deadline) + period;
+    if (now > deadline)
+    {
+      // late: start the next period from now instead of rushing frames to catch up
+      state.missed_deadlines++;
+      deadline = now;
+    }
+    else
+    {
+      double remaining = deadline - now;
+      if (remaining > state.sleep_overshoot)
+      {
+        double requested = remaining - state.sleep_overshoot;
+        platform_sleep(requested);
+
+        double woke = platform_now();
+        double late = (woke - now) - requested;
+        if (late < 0.0)
+          late = 0.0;
+
+        // grow at once, shrink slowly, never eat more than a quarter of the frame in spinning
+        if (late > state.sleep_overshoot)
+          state.sleep_overshoot = late;
+        else
+          state.sleep_overshoot = state.sleep_overshoot * 0.99 + late * 0.01;
+        if (state.sleep_overshoot > period * 0.25)
+          state.sleep_overshoot = period * 0.25;
+
+        state.sleep_time = woke - now;
+        now = woke;
+      }
+
+      double spin_start = now;
+      while (now < deadline)
+        now = platform_now();
+      state.spin_time = now - spin_start;
+    }
+  }
+
+  state.frame_time = now - frame_start;
+  total_frame_time += state.frame_time;
+  total_wait_time += state.sleep_time + state.spin_time;
+  frame_start = now;
+}
+
+void engine_print_pacing_report(void (*print)(const char* line))
+{
+  static const char* mode_names[] = { "unlimited", "target fps", "vsync" };
+
+  char line[256];
+  double avg = state.frames ? total_frame_time / state.frames : 0.0;
+  snprintf(line, sizeof(line),
+    "pacing: %s %.1f fps, %llu frames, %llu missed deadlines, avg frame %.3f ms (%.0f%% waiting)",
+    mode_names[state.mode], state.target_fps, (unsigned long long)state.frames,
+    (unsigned long long)state.missed_deadlines, avg * 1000.0,
+    total_frame_time > 0.0 ? 100.0 * total_wait_time / total_frame_time : 0.0);
+  print(line);
+}
@@ -0,0 +1,295 @@
+/* MIT License
+ * 
+ * Copyright (c) 2024 Dmitry Shapovalov
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+// pipelined mode: frame N+1 is simulated while frame N is rasterized and frame N-1 presented,
+// every frame owns one of PIPELINE_DEPTH slots (game snapshot + backbuffer) on its way:
+//
+//   simulation thread:  FREE     -> act(), capture_frame() -> CAPTURED
+//   render thread:      CAPTURED -> draw_frame()           -> RENDERED
+//   backend thread:     RENDERED -> present                -> FREE
+
+#include "EngineCore.h"
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+enum SlotState {
+  SLOT_FREE,
+  SLOT_CAPTURED,
+  SLOT_RENDERED
+};
+
+// rows start on a cache line, which also covers any SIMD width
+#define BACKBUFFER_ALIGNMENT 64
+
+#define MIN_SCREEN_WIDTH 640
+#define MIN_SCREEN_HEIGHT 480
+#define MAX_SCREEN_WIDTH 7680
+#define MAX_SCREEN_HEIGHT 4320
+
+static void* backbuffers[PIPELINE_DEPTH] = { NULL };
+static void* background = NULL;
+
+// indexed mode: the backbuffers hold palette indices, presented frames are expanded here
+static bool indexed = false;
+static uint32_t* expanded = NULL;
+
+Framebuffer buffer = { NULL, NULL, 1024, 768, 1024 };
+
+static bool pipelined = false;
+static std::mutex slots_mutex;
+static std::condition_variable slots_changed;
+static SlotState slots[PIPELINE_DEPTH] = { SLOT_FREE };
+static uint64_t presented_frames = 0;
+
+static std::thread simulation_thread;
+static std::thread render_thread;
+
+static void wake_all()
+{
+  // quit is not set under the mutex, take it so a waiter can't miss the notification
+  {
+    std::lock_guard<std::mutex> lock(slots_mutex);
+  }
+  slots_changed.notify_all();
+}
+
+static void simulation_proc(double (*clock)(), void (*before_frame)(uint64_t frame))
+{
+  initialize();
+  engine_start(clock());
+
+  for (uint64_t frame = 0;; frame++)
+  {
+    const int slot = int(frame % PIPELINE_DEPTH);
+    {
+      std::unique_lock<std::mutex> lock(slots_mutex);
+      slots_changed.wait(lock, [slot] { return slots[slot] == SLOT_FREE || engine_is_quit_scheduled(); });
+    }
+    if (engine_is_quit_scheduled())
+      break;
+
+    if (before_frame)
+      before_frame(frame);
+
+    if (!engine_simulate(clock()))
+      break;
+
+    {
+      ProfileScope profile(PROFILE_DRAW);
+      capture_frame(slot);
+    }
+    {
+      std::lock_guard<std::mutex> lock(slots_mutex);
+      slots[slot] = SLOT_CAPTURED;
+    }
+    slots_changed.notify_all();
+  }
+  wake_all();
+}
+
+static void render_proc()
+{
+  for (uint64_t frame = 0;; frame++)
+  {
+    const int slot = int(frame % PIPELINE_DEPTH);
+    {
+      std::unique_lock<std::mutex> lock(slots_mutex);
+      slots_changed.wait(lock, [slot] { return slots[slot] == SLOT_CAPTURED || engine_is_quit_scheduled(); });
+    }
+    if (engine_is_quit_scheduled())
+      break;
+
+    engine_set_buffer_data(backbuffers[slot]);
+    {
+      ProfileScope profile(PROFILE_DRAW);
+      draw_frame(slot);
+      engine_flush_draws();
+    }
+    {
+      std::lock_guard<std::mutex> lock(slots_mutex);
+      slots[slot] = SLOT_RENDERED;
+    }
+    slots_changed.notify_all();
+  }
+}
+
+uint32_t* engine_backbuffer(int slot)
+{
+  return indexed ? expanded : (uint32_t*)backbuffers[slot];
+}
+
+void* engine_background()
+{
+  return background;
+}
+
+int engine_buffer_slot()
+{
+  const void* data = engine_buffer_data();
+  for (int slot = 1; slot < PIPELINE_DEPTH; slot++)
+    if (data == backbuffers[slot])
+      return slot;
+  return 0;
+}
+
+void* engine_buffer_data()
+{
+  return indexed ? (void*)buffer.indices : (void*)buffer.pixels;
+}
+
+void engine_set_buffer_data(void* data)
+{
+  if (indexed)
+    buffer.indices = (uint8_t*)data;
+  else
+    buffer.pixels = (uint32_t*)data;
+}
+
+bool engine_set_indexed(bool enable)
+{
+  if (backbuffers[0])
+    return false;
+  indexed = enable;
+  return true;
+}
+
+bool engine_is_indexed()
+{
+  return indexed;
+}
+
+int engine_pixel_size()
+{
+  return indexed ? int(sizeof(uint8_t)) : int(sizeof(uint32_t));
+}
+
+void engine_expand_backbuffer(int slot, const DirtyRegion& region)
+{
+  if (!indexed)
+    return;
+
+  const uint8_t* indices = (const uint8_t*)backbuffers[slot];
+  if (region.full)
+  {
+    expand_indices(expanded, indices, buffer.height * buffer.stride);
+    return;
+  }
+
+  for (int i = 0; i < region.count; i++)
+  {
+    const DirtyRect& rect = region.rects[i];
+    for (int y = rect.top; y < rect.bottom; y++)
+    {
+      const size_t offset = size_t(y) * buffer.stride + rect.left;
+      expand_indices(expanded + offset, indices + offset, rect.right - rect.left);
+    }
+  }
+}
+
+bool engine_set_resolution(int width, int height)
+{
+  if (backbuffers[0] || width < MIN_SCREEN_WIDTH || height < MIN_SCREEN_HEIGHT
+    || width > MAX_SCREEN_WIDTH || height > MAX_SCREEN_HEIGHT)
+    return false;
+
+  buffer.width = width;
+  buffer.height = height;
+  return true;
+}
+
+void engine_create_backbuffers()
+{
+  const int row_alignment = BACKBUFFER_ALIGNMENT / engine_pixel_size();
+  buffer.stride = (buffer.width + row_alignment - 1) / row_alignment * row_alignment;
+
+  // one block for all the slots, the background layer and in indexed mode the expanded frame,
+  // aligned by hand (it stays allocated until exit)
+  const size_t size = size_t(buffer.stride) * buffer.height * engine_pixel_size();
+  const size_t expanded_size = indexed ? size_t(buffer.stride) * buffer.height * sizeof(uint32_t) : 0;
+  const size_t block_size = size * (PIPELINE_DEPTH + 1) + expanded_size + BACKBUFFER_ALIGNMENT;
+  char* block = (char*)malloc(block_size);
+  if (!block)
+    abort();
+  memset(block, 0, block_size);
+
+  char* aligned = block + (BACKBUFFER_ALIGNMENT - uintptr_t(block) % BACKBUFFER_ALIGNMENT) % BACKBUFFER_ALIGNMENT;
+  for (int slot = 0; slot < PIPELINE_DEPTH; slot++)
+    backbuffers[slot] = aligned + size * slot;
+  background = aligned + size * PIPELINE_DEPTH;
+  if (indexed)
+    expanded = (uint32_t*)(aligned + size * (PIPELINE_DEPTH + 1));
+
+  engine_set_buffer_data(backbuffers[0]);
+}
+
+void engine_set_pipelined(bool enable)
+{
+  pipelined = enable;
+}
+
+bool engine_is_pipelined()
+{
+  return pipelined;
+}
+
+void engine_pipeline_start(double (*clock)(), void (*before_frame)(uint64_t frame))
+{
+  simulation_thread = std::thread(simulation_proc, clock, before_frame);
+  render_thread = std::thread(render_proc);
+}
+
+int engine_pipeline_acquire(double timeout)
+{
+  const int slot = int(presented_frames % PIPELINE_DEPTH);
+
+  std::unique_lock<std::mutex> lock(slots_mutex);
+  slots_changed.wait_for(lock, std::chrono::duration<double>(timeout),
+    [slot] { return slots[slot] == SLOT_RENDERED || engine_is_quit_scheduled(); });
+
+  return slots[slot] == SLOT_RENDERED && !engine_is_quit_scheduled() ? slot : -1;
+}
+
+void engine_pipeline_release(int slot)
+{
+  {
+    std::lock_guard<std::mutex> lock(slots_mutex);
+    slots[slot] = SLOT_FREE;
+    presented_frames++;
+  }
+  slots_changed.notify_all();
+}
+
+void engine_pipeline_stop()
+{
+  schedule_quit_game();
+  wake_all();
+
+  if (simulation_thread.joinable())
+    simulation_thread.join();
+  if (render_thread.joinable())
+    render_thread.join();
+}
@@ -0,0 +1,134 @@
+/* MIT License
+ * 
+ * Copyright (c) 2024 Dmitry Shapovalov
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+// per-phase frame timing: phases add their time to per-frame accumulators (from any thread),
+// at the end of every frame those are moved into a ring of the last PROFILE_HISTORY frames,
+// on exit the ring is reported as percentiles and optionally written out as CSV
+
+#include "EngineCore.h"
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#define PROFILE_HISTORY 4096
+
+static const char* phase_names[PROFILE_PHASE_COUNT] = { "input", "integrate", "collide", "spawn", "draw", "present", "capture" };
+
+static std::atomic<uint64_t> phase_ns[PROFILE_PHASE_COUNT];
+
+// milliseconds, the last column is the whole frame
+static float history[PROFILE_HISTORY][PROFILE_PHASE_COUNT + 1];
+static uint64_t profiled_frames = 0;
+
+static std::string csv_path;
+
+ProfileScope::ProfileScope(ProfilePhase phase) :
+  phase(phase), start(platform_now())
+{
+}
+
+ProfileScope::~ProfileScope()
+{
+  phase_ns[phase].fetch_add(uint64_t((platform_now() - start) * 1e9), std::memory_order_relaxed);
+}
+
+void engine_set_profile_csv(const char* path)
+{
+  csv_path = path;
+}
+
+void engine_profile_end_frame(double frame_time)
+{
+  float* row = history[profiled_frames % PROFILE_HISTORY];
+  for (int i = 0; i < PROFILE_PHASE_COUNT; i++)
+    row[i] = float(phase_ns[i].exchange(0, std::memory_order_relaxed) * 1e-6);
+  row[PROFILE_PHASE_COUNT] = float(frame_time * 1000.0);
+  profiled_frames++;
+}
+
+static float percentile(std::vector<float>& values, double p)
+{
+  size_t k = size_t(p * (values.size() - 1) + 0.5);
+  std::nth_element(values.begin(), values.begin() + k, values.end());
+  return values[k];
+}
+
+static void write_csv(void (*print)(const char* line))
+{
+  FILE* f = fopen(csv_path.c_str(), "w");
+  if (!f)
+  {
+    std::string line = "profile: can't create " + csv_path;
+    print(line.c_str());
+    return;
+  }
+
+  fprintf(f, "frame");
+  for (int i = 0; i < PROFILE_PHASE_COUNT; i++)
+    fprintf(f, ",%s_ms", phase_names[i]);
+  fprintf(f, ",total_ms\n");
+
+  const uint64_t count = std::min<uint64_t>(profiled_frames, PROFILE_HISTORY);
+  for (uint64_t frame = profiled_frames - count; frame < profiled_frames; frame++)
+  {
+    const float* row = history[frame % PROFILE_HISTORY];
+    fprintf(f, "%llu", (unsigned long long)frame);
+    for (int i = 0; i <= PROFILE_PHASE_COUNT; i++)
+      fprintf(f, ",%.4f", row[i]);
+    fprintf(f, "\n");
+  }
+  fclose(f);
+}
+
+void engine_print_profile_report(void (*print)(const char* line))
+{
+  const size_t count = size_t(std::min<uint64_t>(profiled_frames, PROFILE_HISTORY));
+
+  char line[256];
+  snprintf(line, sizeof(line), "profile: last %llu of %llu frames (ms)        p50      p95      p99      max",
+    (unsigned long long)count, (unsigned long long)profiled_frames);
+  print(line);
+
+  if (count)
+  {
+    std::vector<float> values(count);
+    for (int i = 0; i <= PROFILE_PHASE_COUNT; i++)
+    {
+      for (size_t k = 0; k < count; k++)
+        values[k] = history[k][i];
+
+      float p50 = percentile(values, 0.50);
+      float p95 = percentile(values, 0.95);
+      float p99 = percentile(values, 0.99);
+      float max = *std::max_element(values.begin(), values.end());
+      snprintf(line, sizeof(line), "  %-38s %8.3f %8.3f %8.3f %8.3f",
+        i < PROFILE_PHASE_COUNT ? phase_names[i] : "total", p50, p95, p99, max);
+      print(line);
+    }
+  }
+
+  if (!csv_path.empty())
+    write_csv(print);
+}
@@ -0,0 +1,443 @@
+/* MIT License
+ * 
+ * Copyright (c) 2024 Dmitry Shapovalov
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+// span fill shared by all the shapes: rows of the framebuffer are contiguous, so a shape is drawn
+// as one fill_span() per row; the widest implementation the CPU supports is picked at startup
+//
+// indexed mode: colors are given palette indices on first use (a lock-free hash lookup, inserts
+// under a mutex), rows are filled with memset and presented regions are expanded through the
+// palette, with AVX2 gathers when available
+
+#include "EngineCore.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <mutex>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#  define RASTER_X86
+#  include <immintrin.h>
+#  ifdef _MSC_VER
+#    include <intrin.h>
+#    define TARGET_SSE2
+#    define TARGET_AVX2
+#  else
+#    include <cpuid.h>
+#    define TARGET_SSE2 __attribute__((target("sse2")))
+#    define TARGET_AVX2 __attribute__((target("avx2")))
+#  endif
+#endif
+
+typedef void (*FillSpanFunction)(uint32_t* dst, int count, uint32_t color);
+typedef void (*ExpandFunction)(uint32_t* dst, const uint8_t* src, int count);
+
+#define PALETTE_SIZE 256
+#define PALETTE_SLOTS 1024  // hash slots, a power of two well above PALETTE_SIZE
+
+static uint32_t palette[PALETTE_SIZE] = { 0 };  // index 0 - black, what clears write
+static int palette_count = 1;
+static int palette_used_slots = 0;
+static uint64_t palette_misses = 0;  // colors past PALETTE_SIZE, mapped to the nearest one
+// 0 - empty, otherwise 1 << 40 | index << 32 | color
+static std::atomic<uint64_t> palette_slots[PALETTE_SLOTS];
+static std::mutex palette_mutex;
+
+static const char* isa_names[] = { "scalar", "sse2", "avx2" };
+
+static void fill_span_scalar(uint32_t* dst, int count, uint32_t color)
+{
+  for (int i = 0; i < count; i++)
+    dst[i] = color;
+}
+
+#ifdef RASTER_X86
+
+// scalar up to an aligned address, aligned vector stores, scalar tail
+
+TARGET_SSE2 static void fill_span_sse2(uint32_t* dst, int count, uint32_t color)
+{
+  for (; count > 0 && (uintptr_t(dst) & 15); count--)
+    *dst++ = color;
+
+  const __m128i value = _mm_set1_epi32(int(color));
+  for (; count >= 8; count -= 8, dst += 8)
+  {
+    _mm_store_si128((__m128i*)dst, value);
+    _mm_store_si128((__m128i*)(dst + 4), value);
+  }
+  for (; count >= 4; count -= 4, dst += 4)
+    _mm_store_si128((__m128i*)dst, value);
+
+  for (; count > 0; count--)
+    *dst++ = color;
+}
+
+TARGET_AVX2 static void fill_span_avx2(uint32_t* dst, int count, uint32_t color)
+{
+  for (; count > 0 && (uintptr_t(dst) & 31); count--)
+    *dst++ = color;
+
+  const __m256i value = _mm256_set1_epi32(int(color));
+  for (; count >= 16; count -= 16, dst += 16)
+  {
+    _mm256_store_si256((__m256i*)dst, value);
+    _mm256_store_si256((__m256i*)(dst + 8), value);
+  }
+  for (; count >= 8; count -= 8, dst += 8)
+    _mm256_store_si256((__m256i*)dst, value);
+
+  for (; count > 0; count--)
+    *dst++ = color;
+}
+
+TARGET_AVX2 static void expand_indices_avx2(uint32_t* dst, const uint8_t* src, int count)
+{
+  for (; count >= 8; count -= 8, dst += 8, src += 8)
+  {
+    const __m256i indices = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)src));
+    _mm256_storeu_si256((__m256i*)dst, _mm256_i32gather_epi32((const int*)palette, indices, 4));
+  }
+  for (; count > 0; count--)
+    *dst++ = palette[*src++];
+}
+
+static void cpuid(int leaf, unsigned regs[4])
+{
+#ifdef _MSC_VER
+  int r[4];
+  __cpuidex(r, leaf, 0);
+  for (int i = 0; i < 4; i++)
+    regs[i] = unsigned(r[i]);
+#else
+  __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static RasterIsa detect_isa()
+{
+  unsigned regs[4];
+  cpuid(0, regs);
+  const unsigned max_leaf = regs[0];
+
+  cpuid(1, regs);
+  if (!(regs[3] & (1u << 26)))
+    return RASTER_ISA_SCALAR;
+
+  // AVX2 needs the CPU bit and the OS saving the ymm registers (OSXSAVE + XCR0 bits 1, 2)
+  const bool osxsave = (regs[2] & (1u << 27)) != 0;
+  if (max_leaf >= 7 && osxsave)
+  {
+#ifdef _MSC_VER
+    const unsigned long long xcr0 = _xgetbv(0);
+#else
+    unsigned eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    const unsigned long long xcr0 = eax | (unsigned long long)edx << 32;
+#endif
+    cpuid(7, regs);
+    if ((xcr0 & 6) == 6 && (regs[1] & (1u << 5)))
+      return RASTER_ISA_AVX2;
+  }
+  return RASTER_ISA_SSE2;
+}
+
+#else
+
+static RasterIsa detect_isa()
+{
+  return RASTER_ISA_SCALAR;
+}
+
+#endif
+
+static const RasterIsa supported_isa = detect_isa();
+static RasterIsa isa = supported_isa;
+
+static FillSpanFunction fill_span_function(RasterIsa which)
+{
+#ifdef RASTER_X86
+  if (which == RASTER_ISA_AVX2)
+    return fill_span_avx2;
+  if (which == RASTER_ISA_SSE2)
+    return fill_span_sse2;
+#endif
+  return fill_span_scalar;
+}
+
+static void expand_indices_scalar(uint32_t* dst, const uint8_t* src, int count)
+{
+  for (int i = 0; i < count; i++)
+    dst[i] = palette[src[i]];
+}
+
+// without gathers a vector version is no faster than the table lookups
+static ExpandFunction expand_function(RasterIsa which)
+{
+#ifdef RASTER_X86
+  if (which == RASTER_ISA_AVX2)
+    return expand_indices_avx2;
+#endif
+  return expand_indices_scalar;
+}
+
+static FillSpanFunction fill_span_impl = fill_span_function(supported_isa);
+static ExpandFunction expand_impl = expand_function(supported_isa);
+
+void fill_span(uint32_t* dst, int count, uint32_t color)
+{
+  fill_span_impl(dst, count, color);
+}
+
+static int palette_find(uint32_t color)
+{
+  for (uint32_t slot = (color * 2654435761u) >> 22;; slot = (slot + 1) & (PALETTE_SLOTS - 1))
+  {
+    const uint64_t entry = palette_slots[slot].load(std::memory_order_acquire);
+    if (!entry)
+      return -1;
+    if (uint32_t(entry) == color)
+      return int(entry >> 32) & 0xFF;
+  }
+}
+
+static int palette_nearest(uint32_t color)
+{
+  int best = 0;
+  int best_distance = 0;
+  for (int i = 0; i < palette_count; i++)
+  {
+    int distance = 0;
+    for (int shift = 0; shift < 24; shift += 8)
+    {
+      int delta = int((color >> shift) & 0xFF) - int((palette[i] >> shift) & 0xFF);
+      distance += delta * delta;
+    }
+    if (i == 0 || distance < best_distance)
+    {
+      best = i;
+      best_distance = distance;
+    }
+  }
+  return best;
+}
+
+uint8_t palette_index(uint32_t color)
+{
+  if (color == palette[0])
+    return 0;
+
+  int index = palette_find(color);
+  if (index >= 0)
+    return uint8_t(index);
+
+  std::lock_guard<std::mutex> lock(palette_mutex);
+  index = palette_find(color);
+  if (index >= 0)
+    return uint8_t(index);
+
+  if (palette_count < PALETTE_SIZE)
+  {
+    index = palette_count++;
+    palette[index] = color;
+  }
+  else
+  {
+    index = palette_nearest(color);
+    palette_misses++;
+  }
+
+  // keep the table half empty so lookups stay short, colors that don't fit are searched every time
+  if (palette_used_slots < PALETTE_SLOTS / 2)
+  {
+    uint32_t slot = (color * 2654435761u) >> 22;
+    while (palette_slots[slot].load(std::memory_order_relaxed))
+      slot = (slot + 1) & (PALETTE_SLOTS - 1);
+    palette_slots[slot].store(uint64_t(1) << 40 | uint64_t(index) << 32 | color, std::memory_order_release);
+    palette_used_slots++;
+  }
+  return uint8_t(index);
+}
+
+void expand_indices(uint32_t* dst, const uint8_t* src, int count)
+{
+  expand_impl(dst, src, count);
+}
+
+void fill_pixels(int y, int x, int count, uint32_t color)
+{
+  if (buffer.indices)
+    memset(buffer.indices + ptrdiff_t(y) * buffer.stride + x, palette_index(color), count);
+  else
+    fill_span_impl(buffer[y] + x, count, color);
+}
+
+ClipRect get_screen_clip_rect()
+{
+  ClipRect clip = { 0, 0, buffer.width, buffer.height };
+  return clip;
+}
+
+void fill_row(int y, int left, int right, uint32_t color, const ClipRect& clip)
+{
+  if (y < clip.top || y >= clip.bottom)
+    return;
+  if (left < clip.left)
+    left = clip.left;
+  if (right > clip.right)
+    right = clip.right;
+  if (right > left)
+    fill_pixels(y, left, right - left, color);
+}
+
+// edge from a to b of a triangle wound so that the inside is where all edge functions are positive,
+// E(x, y) = (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x); along a row E is linear in x, so each
+// edge only limits the row's span from the left (E grows with x) or from the right
+struct TriangleEdge {
+  double ax;
+  double ay;
+  double dx;
+  double dy;
+  double x_per_y;
+};
+
+static TriangleEdge make_edge(double ax, double ay, double bx, double by)
+{
+  TriangleEdge edge = { ax, ay, bx - ax, by - ay, by != ay ? (bx - ax) / (by - ay) : 0.0 };
+  return edge;
+}
+
+int triangle_spans(float x0, float y0, float x1, float y1, float x2, float y2, const ClipRect& clip,
+  ShapeSpan* spans, int max_spans)
+{
+  double area = double(x1 - x0) * (y2 - y0) - double(y1 - y0) * (x2 - x0);
+  if (area == 0.0)
+    return 0;
+  if (area < 0.0)
+  {
+    float t;
+    t = x1; x1 = x2; x2 = t;
+    t = y1; y1 = y2; y2 = t;
+  }
+
+  const TriangleEdge edges[3] = { make_edge(x0, y0, x1, y1), make_edge(x1, y1, x2, y2), make_edge(x2, y2, x0, y0) };
+
+  const double min_y = fmin(y0, fmin(y1, y2));
+  const double max_y = fmax(y0, fmax(y1, y2));
+  const double min_x = fmin(x0, fmin(x1, x2));
+  const double max_x = fmax(x0, fmax(x1, x2));
+
+  // rows whose centers are inside the vertical extent
+  int top = int(ceil(min_y - 0.5));
+  int bottom = int(ceil(max_y - 0.5));
+  if (top < clip.top)
+    top = clip.top;
+  if (bottom > clip.bottom)
+    bottom = clip.bottom;
+
+  int count = 0;
+  for (int y = top; y < bottom && count < max_spans; y++)
+  {
+    const double center_y = y + 0.5;
+    double left = floor(min_x);
+    double right = ceil(max_x) + 1.0;
+
+    for (int i = 0; i < 3; i++)
+    {
+      const TriangleEdge& edge = edges[i];
+      if (edge.dy == 0.0)
+      {
+        if (edge.dx * (center_y - edge.ay) <= 0.0)
+          right = left;
+        continue;
+      }
+
+      // pixel x is inside the left edges when x + 0.5 >= crossing, inside the right ones when below
+      const double crossing = ceil(edge.ax + (center_y - edge.ay) * edge.x_per_y - 0.5);
+      if (edge.dy < 0.0)
+        left = fmax(left, crossing);
+      else
+        right = fmin(right, crossing);
+    }
+
+    if (right > left)
+    {
+      ShapeSpan span = { y, int(left), int(right) };
+      spans[count++] = span;
+    }
+  }
+  return count;
+}
+
+void fill_triangle(float x0, float y0, float x1, float y1, float x2, float y2, uint32_t color, const ClipRect& clip)
+{
+  // in batches of rows, so any height fits the stack buffer
+  ShapeSpan spans[256];
+  ClipRect rows = clip;
+  const int top = int(ceil(fmin(y0, fmin(y1, y2)) - 0.5));
+  const int bottom = int(ceil(fmax(y0, fmax(y1, y2)) - 0.5));
+  if (rows.top < top)
+    rows.top = top;
+  const int last = bottom < clip.bottom ? bottom : clip.bottom;
+
+  while (rows.top < last)
+  {
+    rows.bottom = rows.top + 256 < last ? rows.top + 256 : last;
+
+    int count = triangle_spans(x0, y0, x1, y1, x2, y2, rows, spans, 256);
+    for (int i = 0; i < count; i++)
+      fill_row(spans[i].row, spans[i].left, spans[i].right, color, clip);
+
+    rows.top = rows.bottom;
+  }
+}
+
+bool engine_set_raster_isa(const char* name)
+{
+  for (int i = 0; i <= RASTER_ISA_AVX2; i++)
+  {
+    if (strcmp(name, isa_names[i]) == 0)
+    {
+      // never above what the CPU has
+      isa = RasterIsa(i) < supported_isa ? RasterIsa(i) : supported_isa;
+      fill_span_impl = fill_span_function(isa);
+      expand_impl = expand_function(isa);
+      return true;
+    }
+  }
+  return false;
+}
+
+void engine_print_raster_report(void (*print)(const char* line))
+{
+  char line[256];
+  snprintf(line, sizeof(line), "raster: %s span fill (cpu supports %s)", isa_names[isa], isa_names[supported_isa]);
+  print(line);
+
+  if (engine_is_indexed())
+  {
+    snprintf(line, sizeof(line), "raster: indexed, %d palette colors, %llu colors mapped to the nearest",
+      palette_count, (unsigned long long)palette_misses);
+    print(line);
+  }
+}
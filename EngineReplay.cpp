@@ -0,0 +1,319 @@
+/* MIT License
+ * 
+ * Copyright (c) 2024 Dmitry Shapovalov
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+// input recording and replay
+//
+// file layout (little endian):
+//   header: "AREC", uint32 version, uint32 random seed, float tick rate (0 - variable dt),
+//           uint32 width, uint32 height (the game depends on the resolution)
+//   then one record per act() call: uint8 flags followed by what they announce
+//     TICK_DT      - float dt, otherwise dt of the previous tick
+//     TICK_KEYS    - uint16 count, then count uint8 VK codes whose state flipped
+//     TICK_BUTTONS - uint8: bit 0/1 - mouse buttons, bit 2 - window active
+//     TICK_CURSOR  - int16 x, int16 y
+// so a tick without input changes takes a single byte
+//
+// replays are only valid for the binary that recorded them (rand() and float math must match)
+
+#include "EngineCore.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RECORD_VERSION 2
+
+#define TICK_DT      0x01
+#define TICK_KEYS    0x02
+#define TICK_BUTTONS 0x04
+#define TICK_CURSOR  0x08
+
+static unsigned random_seed = 0;
+static bool random_seed_set = false;
+
+// the file is created by the first recorded tick, so an option refused later on the command
+// line doesn't leave it truncated
+static char* record_path = NULL;
+static FILE* record_file = NULL;
+static float recorded_dt = -1.0f;
+static InputSnapshot recorded_input = { { 0 }, { false, false }, 0, 0, true };
+
+static FILE* replay_file = NULL;
+static float replayed_dt = 0.0f;
+static InputSnapshot replayed_input = { { 0 }, { false, false }, 0, 0, true };
+static double replayed_time = 0.0;
+
+unsigned get_random_seed()
+{
+  if (!random_seed_set)
+    engine_set_random_seed(unsigned(time(0)));
+  return random_seed;
+}
+
+void engine_set_random_seed(unsigned seed)
+{
+  random_seed = seed;
+  random_seed_set = true;
+}
+
+static uint8_t buttons_byte(const InputSnapshot& input)
+{
+  return uint8_t((input.mouse_buttons[0] ? 1 : 0) | (input.mouse_buttons[1] ? 2 : 0) | (input.window_active ? 4 : 0));
+}
+
+bool engine_record_open(const char* path)
+{
+  // appending checks the file can be written without touching its contents
+  FILE* f = fopen(path, "ab");
+  if (!f)
+    return false;
+  fclose(f);
+
+  free(record_path);
+  const size_t size = strlen(path) + 1;
+  record_path = (char*)malloc(size);
+  if (!record_path)
+    return false;
+  memcpy(record_path, path, size);
+  return true;
+}
+
+void engine_record_tick(float dt, const InputSnapshot& input)
+{
+  if (!record_path)
+    return;
+
+  if (!record_file)
+  {
+    record_file = fopen(record_path, "wb");
+    if (!record_file)
+    {
+      free(record_path);
+      record_path = NULL;
+      return;
+    }
+
+    const uint32_t version = RECORD_VERSION;
+    const uint32_t seed = get_random_seed();
+    const float rate = engine_tick_rate();
+    const uint32_t resolution[2] = { uint32_t(SCREEN_WIDTH), uint32_t(SCREEN_HEIGHT) };
+    fwrite("AREC", 1, 4, record_file);
+    fwrite(&version, sizeof(version), 1, record_file);
+    fwrite(&seed, sizeof(seed), 1, record_file);
+    fwrite(&rate, sizeof(rate), 1, record_file);
+    fwrite(resolution, sizeof(resolution), 1, record_file);
+  }
+
+  uint8_t flipped[256];
+  uint16_t flipped_count = 0;
+  for (int code = 0; code < 256; code++)
+    if (((input.keys[code >> 5] ^ recorded_input.keys[code >> 5]) >> (code & 31)) & 1)
+      flipped[flipped_count++] = uint8_t(code);
+
+  const uint8_t buttons = buttons_byte(input);
+
+  uint8_t flags = 0;
+  if (dt != recorded_dt)
+    flags |= TICK_DT;
+  if (flipped_count)
+    flags |= TICK_KEYS;
+  if (buttons != buttons_byte(recorded_input))
+    flags |= TICK_BUTTONS;
+  if (input.cursor_x != recorded_input.cursor_x || input.cursor_y != recorded_input.cursor_y)
+    flags |= TICK_CURSOR;
+
+  fwrite(&flags, 1, 1, record_file);
+  if (flags & TICK_DT)
+    fwrite(&dt, sizeof(dt), 1, record_file);
+  if (flags & TICK_KEYS)
+  {
+    fwrite(&flipped_count, sizeof(flipped_count), 1, record_file);
+    fwrite(flipped, 1, flipped_count, record_file);
+  }
+  if (flags & TICK_BUTTONS)
+    fwrite(&buttons, 1, 1, record_file);
+  if (flags & TICK_CURSOR)
+  {
+    const int16_t cursor[2] = { int16_t(input.cursor_x), int16_t(input.cursor_y) };
+    fwrite(cursor, sizeof(cursor), 1, record_file);
+  }
+
+  recorded_dt = dt;
+  recorded_input = input;
+  recorded_input.cursor_x = int16_t(input.cursor_x);
+  recorded_input.cursor_y = int16_t(input.cursor_y);
+}
+
+void engine_record_close()
+{
+  if (record_file)
+    fclose(record_file);
+  record_file = NULL;
+  free(record_path);
+  record_path = NULL;
+}
+
+bool engine_replay_open(const char* path)
+{
+  replay_file = fopen(path, "rb");
+  if (!replay_file)
+    return false;
+
+  char magic[4];
+  uint32_t version;
+  uint32_t seed;
+  float rate;
+  uint32_t resolution[2];
+  if (fread(magic, 1, 4, replay_file) != 4 || memcmp(magic, "AREC", 4) != 0
+    || fread(&version, sizeof(version), 1, replay_file) != 1 || version != RECORD_VERSION
+    || fread(&seed, sizeof(seed), 1, replay_file) != 1
+    || fread(&rate, sizeof(rate), 1, replay_file) != 1
+    || fread(resolution, sizeof(resolution), 1, replay_file) != 1
+    || !engine_set_resolution(int(resolution[0]), int(resolution[1])))
+  {
+    fclose(replay_file);
+    replay_file = NULL;
+    return false;
+  }
+
+  engine_set_random_seed(seed);
+  return true;
+}
+
+bool engine_is_replaying()
+{
+  return replay_file != NULL;
+}
+
+// reads the next tick into replayed_dt / replayed_input, false at the end of the file
+static bool replay_tick()
+{
+  uint8_t flags;
+  if (fread(&flags, 1, 1, replay_file) != 1)
+    return false;
+
+  if ((flags & TICK_DT) && fread(&replayed_dt, sizeof(replayed_dt), 1, replay_file) != 1)
+    return false;
+
+  if (flags & TICK_KEYS)
+  {
+    uint16_t count;
+    uint8_t flipped[256];
+    if (fread(&count, sizeof(count), 1, replay_file) != 1 || count > 256
+      || fread(flipped, 1, count, replay_file) != count)
+      return false;
+
+    for (int i = 0; i < count; i++)
+      replayed_input.keys[flipped[i] >> 5] ^= 1u << (flipped[i] & 31);
+  }
+
+  if (flags & TICK_BUTTONS)
+  {
+    uint8_t buttons;
+    if (fread(&buttons, 1, 1, replay_file) != 1)
+      return false;
+
+    replayed_input.mouse_buttons[0] = (buttons & 1) != 0;
+    replayed_input.mouse_buttons[1] = (buttons & 2) != 0;
+    replayed_input.window_active = (buttons & 4) != 0;
+  }
+
+  if (flags & TICK_CURSOR)
+  {
+    int16_t cursor[2];
+    if (fread(cursor, sizeof(cursor), 1, replay_file) != 1)
+      return false;
+
+    replayed_input.cursor_x = cursor[0];
+    replayed_input.cursor_y = cursor[1];
+  }
+
+  replayed_time += replayed_dt;
+  replayed_input.time = replayed_time;
+  replayed_input.events = (flags & ~TICK_DT) ? 1 : 0;
+  replayed_input.oldest_event_time = replayed_input.events ? replayed_time : 0.0;
+  return true;
+}
+
+static uint32_t frame_checksum()
+{
+  // FNV-1a over the presented pixels
+  const uint32_t* pixels = engine_backbuffer(0);
+  uint32_t hash = 2166136261u;
+  for (int y = 0; y < SCREEN_HEIGHT; y++)
+    for (int x = 0; x < SCREEN_WIDTH; x++)
+      hash = (hash ^ pixels[ptrdiff_t(y) * buffer.stride + x]) * 16777619u;
+  return hash;
+}
+
+void engine_run_replay(void (*print)(const char* line))
+{
+  // every recorded act() is replayed and drawn at full speed, without interpolation
+  set_fixed_timestep(0.0f, 1);
+  engine_set_capture_lossless(true);
+
+  initialize();
+
+  uint64_t ticks = 0;
+  double start_time = platform_now();
+  double tick_start = start_time;
+  while (!engine_is_quit_scheduled() && replay_tick())
+  {
+    engine_set_input_snapshot(replayed_input);
+    act(replayed_dt);
+
+    if (!engine_is_quit_scheduled())
+    {
+      {
+        ProfileScope profile(PROFILE_DRAW);
+        draw();
+        engine_flush_draws();
+      }
+      DirtyRegion region;
+      engine_take_present_region(0, &region);
+      engine_capture_frame(engine_backbuffer(0), buffer.stride);
+    }
+    ticks++;
+
+    double now = platform_now();
+    engine_profile_end_frame(now - tick_start);
+    tick_start = now;
+  }
+  double elapsed = platform_now() - start_time;
+
+  char line[256];
+  snprintf(line, sizeof(line), "replay: %llu ticks, time: %.3f s, %.1f ticks/s, last frame checksum %08x",
+    (unsigned long long)ticks, elapsed, elapsed > 0.0 ? ticks / elapsed : 0.0, frame_checksum());
+  print(line);
+  engine_capture_stop();
+  engine_render_threads_stop();
+  engine_print_capture_report(print);
+  engine_print_raster_report(print);
+  engine_print_shape_cache_report(print);
+  engine_print_tiles_report(print);
+  engine_print_profile_report(print);
+
+  finalize();
+  fclose(replay_file);
+  replay_file = NULL;
+}
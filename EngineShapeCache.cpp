@@ -0,0 +1,174 @@
+/* MIT License
+ * 
+ * Copyright (c) 2024 Dmitry Shapovalov
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+
+// pre-rasterized shapes: a shape's coverage is stored once as row spans relative to its origin,
+// under a key of what determines it (type, orientation, size); drawing is then one fill_pixels() per
+// stored span; past the size the least recently used entries are dropped once the frame is
+// rendered, so render threads can draw from an entry without holding the lock
+
+#include "EngineCore.h"
+#include <stdio.h>
+#include <string.h>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+struct ShapeSpans {
+  ShapeKey key;
+  std::vector<ShapeSpan> spans;
+  ClipRect bounds;  // relative to the origin, right and bottom excluded
+};
+
+struct ShapeKeyHash {
+  size_t operator()(const ShapeKey& key) const
+  {
+    uint32_t width_bits;
+    uint32_t height_bits;
+    memcpy(&width_bits, &key.width, sizeof(width_bits));
+    memcpy(&height_bits, &key.height, sizeof(height_bits));
+    size_t hash = size_t(key.type) * 31 + size_t(key.orientation);
+    hash = hash * 1000003 ^ width_bits;
+    hash = hash * 1000003 ^ height_bits;
+    return hash;
+  }
+};
+
+static bool operator==(const ShapeKey& a, const ShapeKey& b)
+{
+  return a.type == b.type && a.orientation == b.orientation && a.width == b.width && a.height == b.height;
+}
+
+typedef std::list<ShapeSpans> ShapeList;
+
+static int capacity = SHAPE_CACHE_DEFAULT_SIZE;
+static ShapeList entries;  // most recently used first
+static std::unordered_map<ShapeKey, ShapeList::iterator, ShapeKeyHash> lookup;
+static thread_local ShapeSpans uncached; // the last stored shape when the cache is off
+static std::mutex cache_mutex;
+
+static uint64_t hits = 0;
+static uint64_t misses = 0;
+static uint64_t evictions = 0;
+
+void engine_set_shape_cache_size(int entries_count)
+{
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  capacity = entries_count > 0 ? entries_count : 0;
+  entries.clear();
+  lookup.clear();
+}
+
+const ShapeSpans* find_shape_spans(const ShapeKey& key)
+{
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  auto found = lookup.find(key);
+  if (found == lookup.end())
+  {
+    misses++;
+    return NULL;
+  }
+
+  hits++;
+  entries.splice(entries.begin(), entries, found->second);
+  return &*found->second;
+}
+
+const ShapeSpans* store_shape_spans(const ShapeKey& key, const ShapeSpan* spans, int count)
+{
+  // built outside the lock, another thread may have stored the same shape meanwhile
+  ShapeSpans built;
+  built.key = key;
+  built.spans.assign(spans, spans + count);
+
+  ClipRect bounds = { 0, 0, 0, 0 };
+  for (int i = 0; i < count; i++)
+  {
+    const ShapeSpan& span = spans[i];
+    if (i == 0 || span.left < bounds.left)
+      bounds.left = span.left;
+    if (i == 0 || span.right > bounds.right)
+      bounds.right = span.right;
+    if (i == 0 || span.row < bounds.top)
+      bounds.top = span.row;
+    if (i == 0 || span.row + 1 > bounds.bottom)
+      bounds.bottom = span.row + 1;
+  }
+  built.bounds = bounds;
+
+  if (capacity == 0)
+  {
+    uncached = std::move(built);
+    return &uncached;
+  }
+
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  auto found = lookup.find(key);
+  if (found != lookup.end())
+    return &*found->second;
+
+  entries.push_front(std::move(built));
+  lookup[key] = entries.begin();
+  return &entries.front();
+}
+
+void engine_trim_shape_cache()
+{
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  while ((int)entries.size() > capacity)
+  {
+    lookup.erase(entries.back().key);
+    entries.pop_back();
+    evictions++;
+  }
+}
+
+void draw_shape_spans(const ShapeSpans* shape, int x, int y, uint32_t color, const ClipRect* clip)
+{
+  const ShapeSpan* span = shape->spans.data();
+  const ShapeSpan* end = span + shape->spans.size();
+
+  if (clip && (x + shape->bounds.left < clip->left || x + shape->bounds.right > clip->right
+    || y + shape->bounds.top < clip->top || y + shape->bounds.bottom > clip->bottom))
+  {
+    for (; span != end; span++)
+      fill_row(y + span->row, x + span->left, x + span->right, color, *clip);
+    return;
+  }
+
+  for (; span != end; span++)
+    fill_pixels(y + span->row, x + span->left, span->right - span->left, color);
+}
+
+void engine_print_shape_cache_report(void (*print)(const char* line))
+{
+  size_t spans = 0;
+  for (const ShapeSpans& entry : entries)
+    spans += entry.spans.size();
+
+  char line[256];
+  snprintf(line, sizeof(line), "shape cache: %d/%d entries, %llu spans, %llu hits, %llu misses, %llu evictions",
+    (int)entries.size(), capacity, (unsigned long long)spans, (unsigned long long)hits,
+    (unsigned long long)misses, (unsigned long long)evictions);
+  print(line);
+}
@@ -0,0 +1,253 @@
+/* MIT License
+ * 
+ * Copyright (c) 2024 Dmitry Shapovalov
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+*/
+// tile renderer: draw calls submitted during draw() / draw_frame() are only recorded, then
+// engine_flush_draws() bins them by their bounds into TILE_SIZE x TILE_SIZE screen tiles and
+// the tiles are rasterized in parallel: a tile is taken by one thread at a time and its calls run
+// in submission order with the tile as the clip, so threads never write the same pixel and the
+// painter's order is kept. With one render thread the calls just run in order, clipped to the screen.
+
+#include "EngineCore.h"
+#include <stdio.h>
+#include <string.h>
+#include <cstddef>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+#define MAX_RENDER_THREADS 64
+
+struct DrawCall {
+  ClipRect bounds;
+  DrawCallback draw;
+  size_t data;  // offset in call_data
+};
+
+static std::vector<DrawCall> calls;
+static std::vector<char> call_data;
+
+static int tile_columns = 0;
+static int tile_rows = 0;
+static std::vector<std::vector<int> > tile_calls;  // call indices per tile, in submission order
+static std::vector<int> busy_tiles;                 // tiles with at least one call
+static std::atomic<int> next_tile(0);
+
+static int render_threads = 0;  // including the flushing thread, 0 - one per core
+static std::vector<std::thread> workers;
+static std::mutex pool_mutex;
+static std::condition_variable pool_wake;
+static std::condition_variable pool_done;
+static uint64_t pool_generation = 0;
+static int pool_running = 0;
+static bool pool_stopping = false;
+
+static uint64_t flushed_frames = 0;
+static uint64_t flushed_calls = 0;
+static uint64_t binned_calls = 0;
+static uint64_t flushed_tiles = 0;
+
+void submit_draw(const ClipRect& bounds, DrawCallback draw, const void* data, size_t size)
+{
+  ClipRect screen = get_screen_clip_rect();
+  if (bounds.right <= screen.left || bounds.left >= screen.right
+    || bounds.bottom <= screen.top || bounds.top >= screen.bottom)
+    return;
+
+  const size_t alignment = alignof(std::max_align_t);
+  const size_t offset = (call_data.size() + alignment - 1) / alignment * alignment;
+  call_data.resize(offset + size);
+  memcpy(call_data.data() + offset, data, size);
+
+  DrawCall call = { bounds, draw, offset };
+  calls.push_back(call);
+}
+
+void engine_set_render_threads(int count)
+{
+  render_threads = count > 0 ? (count < MAX_RENDER_THREADS ? count : MAX_RENDER_THREADS) : 0;
+}
+
+static int render_thread_count()
+{
+  if (render_threads > 0)
+    return render_threads;
+
+  int cores = int(std::thread::hardware_concurrency());
+  return cores < 1 ? 1 : (cores < MAX_RENDER_THREADS ? cores : MAX_RENDER_THREADS);
+}
+
+static void render_tiles()
+{
+  const ClipRect screen = get_screen_clip_rect();
+  for (;;)
+  {
+    const int index = next_tile.fetch_add(1, std::memory_order_relaxed);
+    if (index >= (int)busy_tiles.size())
+      break;
+
+    const int tile = busy_tiles[index];
+    ClipRect clip;
+    clip.left = tile % tile_columns * TILE_SIZE;
+    clip.top = tile / tile_columns * TILE_SIZE;
+    clip.right = clip.left + TILE_SIZE < screen.right ? clip.left + TILE_SIZE : screen.right;
+    clip.bottom = clip.top + TILE_SIZE < screen.bottom ? clip.top + TILE_SIZE : screen.bottom;
+
+    for (int call : tile_calls[tile])
+      calls[call].draw(call_data.data() + calls[call].data, clip);
+  }
+}
+
+// generation - the last flush the worker has seen
+static void worker_proc(uint64_t generation)
+{
+  for (;;)
+  {
+    {
+      std::unique_lock<std::mutex> lock(pool_mutex);
+      pool_wake.wait(lock, [&generation] { return pool_generation != generation || pool_stopping; });
+      if (pool_stopping)
+        return;
+      generation = pool_generation;
+    }
+
+    render_tiles();
+
+    bool last;
+    {
+      std::lock_guard<std::mutex> lock(pool_mutex);
+      last = --pool_running == 0;
+    }
+    if (last)
+      pool_done.notify_one();
+  }
+}
+
+static void bin_calls()
+{
+  const ClipRect screen = get_screen_clip_rect();
+  const int columns = (screen.right + TILE_SIZE - 1) / TILE_SIZE;
+  const int rows = (screen.bottom + TILE_SIZE - 1) / TILE_SIZE;
+  if (columns != tile_columns || rows != tile_rows)
+  {
+    tile_columns = columns;
+    tile_rows = rows;
+    tile_calls.assign(size_t(columns) * rows, std::vector<int>());
+  }
+
+  for (std::vector<int>& list : tile_calls)
+    list.clear();
+  busy_tiles.clear();
+
+  for (int i = 0; i < (int)calls.size(); i++)
+  {
+    const ClipRect& bounds = calls[i].bounds;
+    const int left = (bounds.left > 0 ? bounds.left : 0) / TILE_SIZE;
+    const int top = (bounds.top > 0 ? bounds.top : 0) / TILE_SIZE;
+    const int right = (bounds.right < screen.right ? bounds.right - 1 : screen.right - 1) / TILE_SIZE;
+    const int bottom = (bounds.bottom < screen.bottom ? bounds.bottom - 1 : screen.bottom - 1) / TILE_SIZE;
+
+    for (int row = top; row <= bottom; row++)
+      for (int column = left; column <= right; column++)
+      {
+        std::vector<int>& list = tile_calls[row * tile_columns + column];
+        if (list.empty())
+          busy_tiles.push_back(row * tile_columns + column);
+        list.push_back(i);
+      }
+    binned_calls += (bottom - top + 1) * (right - left + 1);
+  }
+  flushed_tiles += busy_tiles.size();
+}
+
+void engine_flush_draws()
+{
+  const int threads = render_thread_count();
+  if (threads == 1)
+  {
+    const ClipRect screen = get_screen_clip_rect();
+    for (const DrawCall& call : calls)
+      call.draw(call_data.data() + call.data, screen);
+  }
+  else
+  {
+    bin_calls();
+
+    if ((int)workers.size() < threads - 1)
+    {
+      std::lock_guard<std::mutex> lock(pool_mutex);
+      while ((int)workers.size() < threads - 1)
+        workers.emplace_back(worker_proc, pool_generation);
+    }
+
+    next_tile.store(0, std::memory_order_relaxed);
+    {
+      std::lock_guard<std::mutex> lock(pool_mutex);
+      pool_generation++;
+      pool_running = (int)workers.size();
+    }
+    pool_wake.notify_all();
+
+    render_tiles();
+
+    std::unique_lock<std::mutex> lock(pool_mutex);
+    pool_done.wait(lock, [] { return pool_running == 0; });
+  }
+
+  flushed_frames++;
+  flushed_calls += calls.size();
+  calls.clear();
+  call_data.clear();
+
+  // nothing is drawing any more, shapes stored during the frame may be evicted now
+  engine_trim_shape_cache();
+}
+
+void engine_render_threads_stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    pool_stopping = true;
+  }
+  pool_wake.notify_all();
+
+  for (std::thread& worker : workers)
+    worker.join();
+  workers.clear();
+  pool_stopping = false;
+}
+
+void engine_print_tiles_report(void (*print)(const char* line))
+{
+  const int threads = render_thread_count();
+  char line[256];
+  if (threads == 1)
+    snprintf(line, sizeof(line), "tiles: off (1 render thread), %.1f draw calls per frame",
+      flushed_frames ? double(flushed_calls) / flushed_frames : 0.0);
+  else
+    snprintf(line, sizeof(line), "tiles: %dx%d px, %d render threads, %.1f draw calls and %.1f busy tiles per frame, %.2f tiles per call",
+      TILE_SIZE, TILE_SIZE, threads, flushed_frames ? double(flushed_calls) / flushed_frames : 0.0,
+      flushed_frames ? double(flushed_tiles) / flushed_frames : 0.0,
+      flushed_calls ? double(binned_calls) / flushed_calls : 0.0);
+  print(line);
+}
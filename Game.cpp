@@ -26,6 +26,10 @@
 #include <memory.h>
 #include <string>
 #include <vector>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
 #include <cmath>
 #include <random>
 #include <ctime>
@@ -35,7 +39,7 @@
 //
 //  get_cursor_x(), get_cursor_y() - get mouse cursor position
 //  is_mouse_button_pressed(int button) - check if mouse button is pressed (0 - left button, 1 - right button)
-//  clear_buffer() - set all pixels in buffer to 'black'
+//  clear_buffer() - set pixels drawn by the previous frame in buffer to 'black'
 //  is_window_active() - returns true if window is active
 //  schedule_quit_game() - quit game after act()
 
@@ -61,6 +65,16 @@ namespace Constants {
 
     const float rotate_degree = 20;
 
+    //render commands drawn by one draw call of the tile renderer
+    const size_t render_batch_size = 32;
+
+    //side of the collision broadphase grid cells
+    const short collision_cell_size = 64;
+    //bodies covering more grid cells are tested against every other body instead
+    const int collision_large_cells = 64;
+    //how far a body moves before its collision tree leaf is reinserted
+    const float collision_tree_margin = 8.0f;
+
 };
 
 namespace Global {
@@ -189,6 +203,27 @@ enum ShapeType {
     RightTriangle_e
 };
 
+//one shape as draw() records it: plain data, executed by the render threads without virtual calls
+struct RenderCommand
+{
+    ShapeType type;
+    Angle orientation;
+    float x; //coordinate with the draw offset applied, x is the row
+    float y;
+    float sizeX;
+    float sizeY;
+    uint32_t color;
+    ClipRect bounds; //pixels the command can touch
+};
+
+
+//how a layered shape touches a masked one: normal is the unit vector from the layered shape towards
+//the masked one, depth how far they overlap along it
+struct Contact
+{
+    Point2DF normal;
+    float depth = 0;
+};
 
 struct PrimitiveShape
 {
@@ -213,8 +248,25 @@ public:
     void set_color(const uint32_t& color) { this->_color = color; };
     void set_current_angle(const Angle& angle) { this->_currentAngle = angle; };
 
-    virtual void draw() = 0;
+    //the shape moved by offset as a render command
+    RenderCommand get_render_command(Point2DF offset) {
+        Point2DF coordinate = this->_coordinate;
+        coordinate = coordinate + offset;
+        RenderCommand command = { this->get_shapeType(), this->_currentAngle, coordinate.get_x(), coordinate.get_y(),
+            this->_size.get_x(), this->_size.get_y(), this->_color, this->get_bounds(offset) };
+        return command;
+    };
+
     virtual void rotate_right() = 0;
+
+    //pixels draw() can touch in screen coordinates (x is the row)
+    ClipRect get_bounds(Point2DF offset = Point2DF(0.0, 0.0)) const {
+        Point2DF coordinate = this->_coordinate;
+        coordinate = coordinate + offset;
+        ClipRect bounds = { (int)coordinate.get_y(), (int)coordinate.get_x(),
+            (int)(coordinate.get_y() + this->_size.get_y()) + 2, (int)(coordinate.get_x() + this->_size.get_x()) + 2 };
+        return bounds;
+    };
     virtual void mirror_shape() = 0;
 
 
@@ -327,40 +379,110 @@ public:
         return *this;
     };
 
-    bool is_collided_with_shape(PrimitiveShape* shape) {
-        Point2DF maskedBodyTopLeft = this->get_coordinate();
-        Point2DF maskedBodyBottomRight = this->get_coordinate() + this->get_size();
-        Point2DF layeredBodyTopLeft = shape->get_coordinate();
-        Point2DF layeredBodyBottomRight = shape->get_coordinate() + shape->get_size();
+    //exact overlap test of shape (the layered one) with this shape (the masked one), contact is filled
+    //when they overlap; circles of equal width and height are tested as circles, other shapes as boxes
+    bool is_collided_with_shape(PrimitiveShape* shape, Contact* contact = NULL) {
+        Contact found;
+        bool collided;
+        if (shape->is_round() && this->is_round())
+            collided = collide_circles(shape->get_center(), shape->get_size().get_x() / 2,
+                this->get_center(), this->get_size().get_x() / 2, found);
+        else if (shape->is_round())
+            collided = collide_circle_box(shape->get_center(), shape->get_size().get_x() / 2,
+                this->get_coordinate(), this->get_coordinate() + this->get_size(), found);
+        else if (this->is_round()) {
+            collided = collide_circle_box(this->get_center(), this->get_size().get_x() / 2,
+                shape->get_coordinate(), shape->get_coordinate() + shape->get_size(), found);
+            found.normal = found.normal * -1.0f;
+        }
+        else
+            collided = collide_boxes(shape->get_coordinate(), shape->get_coordinate() + shape->get_size(),
+                this->get_coordinate(), this->get_coordinate() + this->get_size(), found);
+
+        if (collided && contact)
+            *contact = found;
+        return collided;
+    }
 
-        bool leftUpInnerX = ((maskedBodyTopLeft.get_x() < layeredBodyTopLeft.get_x())
-            && (layeredBodyTopLeft.get_x() < maskedBodyBottomRight.get_x())) ? true : false;
+    bool is_round() {
+        return (this->get_shapeType() == ShapeType::Circle_e) && (this->get_size().get_x() == this->get_size().get_y());
+    }
 
-        bool leftUpInnerY = ((maskedBodyTopLeft.get_y() < layeredBodyTopLeft.get_y())
-            && (layeredBodyTopLeft.get_y() < maskedBodyBottomRight.get_y())) ? true : false;
+    //overlapping intervals on both axes, the contact is along the axis they overlap the least
+    static bool collide_boxes(Point2DF topLeft, Point2DF bottomRight, Point2DF otherTopLeft, Point2DF otherBottomRight, Contact& contact) {
+        const float overlapX = std::min(bottomRight.get_x(), otherBottomRight.get_x()) - std::max(topLeft.get_x(), otherTopLeft.get_x());
+        const float overlapY = std::min(bottomRight.get_y(), otherBottomRight.get_y()) - std::max(topLeft.get_y(), otherTopLeft.get_y());
+        if ((overlapX <= 0) || (overlapY <= 0))
+            return false;
 
-        bool rightBottomInnerX = ((maskedBodyTopLeft.get_x() < layeredBodyBottomRight.get_x())
-            && (layeredBodyBottomRight.get_x() < maskedBodyBottomRight.get_x())) ? true : false;
+        if (overlapX < overlapY) {
+            const bool after = otherTopLeft.get_x() + otherBottomRight.get_x() >= topLeft.get_x() + bottomRight.get_x();
+            contact.normal = Point2DF(after ? 1.0f : -1.0f, 0);
+            contact.depth = overlapX;
+        }
+        else {
+            const bool after = otherTopLeft.get_y() + otherBottomRight.get_y() >= topLeft.get_y() + bottomRight.get_y();
+            contact.normal = Point2DF(0, after ? 1.0f : -1.0f);
+            contact.depth = overlapY;
+        }
+        return true;
+    }
 
-        bool rightBottomInnerY = ((maskedBodyTopLeft.get_y() < layeredBodyBottomRight.get_y())
-            && (layeredBodyBottomRight.get_y() < maskedBodyBottomRight.get_y())) ? true : false;
+    //closer centers than the sum of the radii, compared squared
+    static bool collide_circles(Point2DF center, float radius, Point2DF otherCenter, float otherRadius, Contact& contact) {
+        const Point2DF distance = otherCenter - center;
+        const float squared = distance.get_x() * distance.get_x() + distance.get_y() * distance.get_y();
+        const float radii = radius + otherRadius;
+        if (squared >= radii * radii)
+            return false;
 
-        bool pointLeftUpInner = (leftUpInnerX && leftUpInnerY == true) ? true : false;
-        bool pointLeftBottomInner = (leftUpInnerX && rightBottomInnerY == true) ? true : false;
-        bool pointRightUpInner = (rightBottomInnerX && leftUpInnerY == true) ? true : false;
-        bool pointRightBottomInner = (rightBottomInnerX && rightBottomInnerY == true) ? true : false;
+        const float length = std::sqrt(squared);
+        contact.normal = (length > 0) ? Point2DF(distance.get_x() / length, distance.get_y() / length) : Point2DF(1.0f, 0);
+        contact.depth = radii - length;
+        return true;
+    }
 
+    //the point of the box closest to the center is inside the circle; a center inside the box
+    //leaves through the nearest side
+    static bool collide_circle_box(Point2DF center, float radius, Point2DF topLeft, Point2DF bottomRight, Contact& contact) {
+        Point2DF closest(std::min(std::max(center.get_x(), topLeft.get_x()), bottomRight.get_x()),
+            std::min(std::max(center.get_y(), topLeft.get_y()), bottomRight.get_y()));
+        const Point2DF distance = closest - center;
+        const float squared = distance.get_x() * distance.get_x() + distance.get_y() * distance.get_y();
+        if (squared >= radius * radius)
+            return false;
 
-        if (pointLeftUpInner || pointLeftBottomInner || pointRightUpInner || pointRightBottomInner)
+        if (squared > 0) {
+            const float length = std::sqrt(squared);
+            contact.normal = Point2DF(distance.get_x() / length, distance.get_y() / length);
+            contact.depth = radius - length;
             return true;
+        }
 
-        return false;
+        const float sides[4] = { center.get_x() - topLeft.get_x(), bottomRight.get_x() - center.get_x(),
+            center.get_y() - topLeft.get_y(), bottomRight.get_y() - center.get_y() };
+        const Point2DF normals[4] = { Point2DF(1.0f, 0), Point2DF(-1.0f, 0), Point2DF(0, 1.0f), Point2DF(0, -1.0f) };
+        int nearest = 0;
+        for (int side = 1; side < 4; side++)
+            if (sides[side] < sides[nearest])
+                nearest = side;
+        contact.normal = normals[nearest];
+        contact.depth = radius + sides[nearest];
+        return true;
     }
 
-
     virtual ShapeType get_shapeType() = 0;
 
 protected:
+    //every shape type has a static draw_command(command, clip) that fills its rows with fill_row(),
+    //clip is NULL when the shape is known to be inside; it runs on render threads
+    static void fill_row(int32_t row, int32_t first, int32_t end, uint32_t color, const ClipRect* clip) {
+        if (clip)
+            ::fill_row(row, first, end, color, *clip);
+        else if (end > first)
+            fill_pixels(row, first, end - first, color);
+    };
+
     Point2DF _coordinate;
     Point2DF _size;
     uint32_t _color;
@@ -387,22 +509,49 @@ public:
     Rectangle(const PrimitiveShape& shape) : FullSideShape(shape) {};
     ~Rectangle() {};
 
-    void draw() {
-        uint32_t startX = this->_coordinate.get_x();
-        uint32_t startY = this->_coordinate.get_y();
-        uint32_t sizeX = this->_size.get_x() + startX;
-        uint32_t sizeY = this->_size.get_y() + startY;
+    static void draw_command(const RenderCommand& command, const ClipRect* clip) {
+        int32_t startX = command.x;
+        int32_t startY = command.y;
+        int32_t sizeX = command.sizeX + startX;
+        int32_t sizeY = command.sizeY + startY;
 
-        for (uint32_t j = startY; j < sizeY; j++) {
-            for (uint32_t i = startX; i < sizeX; i++) {
-                buffer[i][j] = this->_color;
-            }
+        for (int32_t i = startX; i < sizeX; i++) {
+            fill_row(i, startY, sizeY, command.color, clip);
         }
     };
 
+public:
     ShapeType get_shapeType() { return ShapeType::Rectangle_e; };
 };
 
+constexpr int32_t integer_sqrt(int32_t value) {
+    int32_t root = 0;
+    while ((root + 1) * (root + 1) <= value)
+        root++;
+    return root;
+}
+
+//spans of a round circle with the radius known at compile time, the rows Circle::draw_command()
+//builds at run time for a == b
+template <int32_t Radius>
+struct CircleSpanTable
+{
+    static constexpr int32_t count = 2 * Radius - 1;
+
+    constexpr CircleSpanTable() : spans() {
+        for (int32_t i = 1 - Radius; i < Radius; i++) {
+            int32_t squared = Radius * Radius - i * i;
+            int32_t left = integer_sqrt(squared);
+            int32_t right = (left * left == squared) ? left : left + 1;
+            spans[i + Radius - 1].row = i + Radius;
+            spans[i + Radius - 1].left = Radius - left;
+            spans[i + Radius - 1].right = Radius + right;
+        }
+    };
+
+    ShapeSpan spans[count];
+};
+
 struct Circle : public FullSideShape
 {
 public:
@@ -410,39 +559,59 @@ public:
     Circle(const PrimitiveShape& shape) : FullSideShape(shape) {};
     ~Circle() {};
 
-    void draw() {
-        uint32_t startX = this->_coordinate.get_x();
-        uint32_t startY = this->_coordinate.get_y();
+    static void draw_command(const RenderCommand& command, const ClipRect* clip) {
+        int32_t startX = command.x;
+        int32_t startY = command.y;
 
-        int32_t a = this->_size.get_x() / 2;
-        int32_t b = this->_size.get_y() / 2;
+        int32_t a = command.sizeX / 2;
+        int32_t b = command.sizeY / 2;
 
-        //1
-        for (int32_t i = 0; i < a; i++) {
-            for (int32_t j = 0; j < std::sqrt(((a * a - i * i) * b * b) / (a * a)); j++) {
-                buffer[i + startX + a][j + startY + b] = this->_color;
-            }
-        }
-        //2
-        for (int32_t i = 0; i < a; i++) {
-            for (int32_t j = -std::sqrt(((a * a - i * i) * b * b) / (a * a)); j < 0; j++) {
-                buffer[i + startX + a][j + startY + b] = this->_color;
-            }
-        }
-        //3
-        for (int32_t i = 0; i > -a; i--) {
-            for (int32_t j = -std::sqrt(((a * a - i * i) * b * b) / (a * a)); j < 0; j++) {
-                buffer[i + startX + a][j + startY + b] = this->_color;
+        //sizes the bodies use are drawn from tables built by the compiler, no cache lookup
+        if (a == b) {
+            switch (a) {
+            case Constants::size_unit / 2: //Projectile, Ship's nose
+                draw_table<Constants::size_unit / 2>(startX, startY, command.color, clip);
+                return;
+            case Constants::size_unit: //Asteroid3
+                draw_table<Constants::size_unit>(startX, startY, command.color, clip);
+                return;
+            case Constants::size_unit * 3 / 2: //Ship, ShipIcon
+                draw_table<Constants::size_unit * 3 / 2>(startX, startY, command.color, clip);
+                return;
+            case Constants::size_unit * 5 / 2: //Asteroid2
+                draw_table<Constants::size_unit * 5 / 2>(startX, startY, command.color, clip);
+                return;
+            case Constants::size_unit * 5: //Asteroid1
+                draw_table<Constants::size_unit * 5>(startX, startY, command.color, clip);
+                return;
             }
         }
-        //4
-        for (int32_t i = 0; i > -a; i--) {
-            for (int32_t j = 0; j < std::sqrt(((a * a - i * i) * b * b) / (a * a)); j++) {
-                buffer[i + startX + a][j + startY + b] = this->_color;
+
+        ShapeKey key = { (int)ShapeType::Circle_e, 0, (float)a, (float)b };
+        const ShapeSpans* spans = find_shape_spans(key);
+        if (!spans) {
+            //one span per row (x is the row), half width sqrt(((a*a - i*i)*b*b)/(a*a)) is computed once,
+            //left edge rounded down and right edge up as the old per-pixel quadrant loops covered it
+            std::vector<ShapeSpan> rows;
+            for (int32_t i = 1 - a; i < a; i++) {
+                int32_t squared = ((a * a - i * i) * b * b) / (a * a);
+                int32_t left = (int32_t)std::sqrt(squared);
+                int32_t right = (left * left == squared) ? left : left + 1;
+                rows.push_back({ i + a, b - left, b + right });
             }
+            spans = store_shape_spans(key, rows.data(), (int)rows.size());
         }
+        draw_shape_spans(spans, startY, startX, command.color, clip);
+    };
+
+    template <int32_t Radius>
+    static void draw_table(int32_t row, int32_t column, uint32_t color, const ClipRect* clip) {
+        static constexpr CircleSpanTable<Radius> table;
+        for (int32_t i = 0; i < table.count; i++)
+            fill_row(row + table.spans[i].row, column + table.spans[i].left, column + table.spans[i].right, color, clip);
     };
 
+public:
     ShapeType get_shapeType() { return ShapeType::Circle_e; };
 };
 
@@ -454,48 +623,35 @@ public:
     RightTriangle(const PrimitiveShape& shape) : PrimitiveShape(shape) {};
     ~RightTriangle() {};
 
-    void draw() {
-        uint32_t startX = this->_coordinate.get_x();
-        uint32_t startY = this->_coordinate.get_y();
-
-        float_t g;
-
-        int32_t step = 1;
-
-        g = (float_t)this->_size.get_y() / this->_size.get_x();
-
-
-        switch (_currentAngle) {
-        case Angle::BottomLeft_e:
-            for (uint32_t i = 0; i < this->_size.get_x(); i++) {
-                for (uint32_t j = 0; j < i * g; j++) {
-                    buffer[i + startX][j + startY] = this->_color;
-                }
-            }
-            break;
-        case Angle::BottomRight_e:
-            for (uint32_t i = 0; i < this->_size.get_x(); i++) {
-                for (uint32_t j = this->_size.get_y(); j > (this->_size.get_y() - (i * g)); j--) {
-                    buffer[i + startX][j + startY] = this->_color;
-                }
-            }
-            break;
-        case Angle::TopLeft_e:
-            for (uint32_t i = 0; i < this->_size.get_x(); i++) {
-                for (uint32_t j = 0; j < (this->_size.get_y() - (i * g)); j++) {
-                    buffer[i + startX][j + startY] = this->_color;
-                }
+    static void draw_command(const RenderCommand& command, const ClipRect* clip) {
+        int32_t startX = command.x;
+        int32_t startY = command.y;
+        float height = command.sizeX;
+        float width = command.sizeY;
+
+        ShapeKey key = { (int)ShapeType::RightTriangle_e, (int)command.orientation, width, height };
+        const ShapeSpans* spans = find_shape_spans(key);
+        if (!spans) {
+            float v[6];
+            for (int i = 0; i < 6; i += 2) {
+                v[i] = corners[command.orientation][i] * width;
+                v[i + 1] = corners[command.orientation][i + 1] * height;
             }
-            break;
-        case Angle::TopRight_e:
-            for (uint32_t i = 0; i < this->_size.get_x(); i++) {
-                for (uint32_t j = (i * g); j < this->_size.get_y(); j++) {
-                    buffer[i + startX][j + startY] = this->_color;
-                }
-            }
-            break;
+            ClipRect rows = { 0, 0, (int)width + 1, (int)height + 1 };
+            std::vector<ShapeSpan> built(rows.bottom);
+            int count = triangle_spans(v[0], v[1], v[2], v[3], v[4], v[5], rows, built.data(), (int)built.size());
+            spans = store_shape_spans(key, built.data(), count);
         }
+        draw_shape_spans(spans, startY, startX, command.color, clip);
+    };
 
+    //vertices as (column, row) in units of (width, height) for every Angle, the right angle is at
+    //the corner the orientation names
+    static constexpr float corners[4][6] = {
+        { 0, 0, 0, 1, 1, 1 }, //BottomLeft_e
+        { 1, 0, 0, 1, 1, 1 }, //BottomRight_e
+        { 0, 0, 1, 0, 0, 1 }, //TopLeft_e
+        { 0, 0, 1, 0, 1, 1 }, //TopRight_e
     };
 
     void rotate_right() {
@@ -536,6 +692,85 @@ public:
     ShapeType get_shapeType() { return ShapeType::RightTriangle_e; };
 };
 
+//render commands of one frame: recorded from the scene, then submitted to the tile renderer in
+//batches of consecutive commands of one type, so a render thread draws a batch in one loop over
+//plain data; batches keep the recorded order, later commands are drawn over earlier ones
+struct RenderCommandList
+{
+public:
+    void clear() { this->_commands.clear(); };
+
+    void add(PrimitiveShape* shape, Point2DF offset) {
+        this->_commands.push_back(shape->get_render_command(offset));
+    };
+
+    //reports the pixels every command can touch and submits the batches; the list must not change
+    //until the frame is rendered
+    void submit() const {
+        size_t first = 0;
+        while (first < this->_commands.size()) {
+            RenderBatch batch = { this, first, first };
+            ClipRect bounds = this->_commands[first].bounds;
+            for (; (batch.end < this->_commands.size()) && (batch.end - first < Constants::render_batch_size)
+                && (this->_commands[batch.end].type == this->_commands[first].type); batch.end++) {
+                const ClipRect& command = this->_commands[batch.end].bounds;
+                add_dirty_rect(command.left, command.top, command.right, command.bottom);
+                bounds.left = std::min(bounds.left, command.left);
+                bounds.top = std::min(bounds.top, command.top);
+                bounds.right = std::max(bounds.right, command.right);
+                bounds.bottom = std::max(bounds.bottom, command.bottom);
+            }
+            submit_draw(bounds, &RenderCommandList::draw_batch, &batch, sizeof(batch));
+            first = batch.end;
+        }
+    };
+
+private:
+    struct RenderBatch {
+        const RenderCommandList* list;
+        size_t first;
+        size_t end;
+    };
+
+    static void draw_batch(const void* data, const ClipRect& clip) {
+        const RenderBatch* batch = (const RenderBatch*)data;
+        const RenderCommand* first = batch->list->_commands.data() + batch->first;
+        const RenderCommand* end = batch->list->_commands.data() + batch->end;
+        switch (first->type) {
+        case ShapeType::Rectangle_e:
+            draw_commands<Rectangle>(first, end, clip);
+            break;
+        case ShapeType::Circle_e:
+            draw_commands<Circle>(first, end, clip);
+            break;
+        case ShapeType::RightTriangle_e:
+            draw_commands<RightTriangle>(first, end, clip);
+            break;
+        default:
+            break;
+        }
+    };
+
+    //commands outside clip are skipped, commands inside it are drawn without per-row clipping
+    template <typename Shape>
+    static void draw_commands(const RenderCommand* command, const RenderCommand* end, const ClipRect& clip) {
+        for (; command != end; command++) {
+            const ClipRect& bounds = command->bounds;
+            if ((bounds.right <= clip.left) || (bounds.left >= clip.right)
+                || (bounds.bottom <= clip.top) || (bounds.top >= clip.bottom))
+                continue;
+
+            if ((bounds.left >= clip.left) && (bounds.right <= clip.right)
+                && (bounds.top >= clip.top) && (bounds.bottom <= clip.bottom))
+                Shape::draw_command(*command, NULL);
+            else
+                Shape::draw_command(*command, &clip);
+        }
+    };
+
+    std::vector<RenderCommand> _commands;
+};
+
 struct CompositeShape
 {
 public:
@@ -547,10 +782,6 @@ public:
         this->_shapes.clear();
     };
 
-    void clear() {
-        this->_shapes.clear();
-    }
-
     void add_shape(Rectangle shape) {
         PrimitiveShape* tmp = new Rectangle(shape);
         this->_shapes.push_back(tmp);
@@ -595,10 +826,9 @@ public:
         }
     };
 
-    void draw() {
-        for (auto i : _shapes) {
-            i->draw();
-        }
+    void record(RenderCommandList* commands, Point2DF offset = Point2DF(0.0, 0.0)) {
+        for (auto i : _shapes)
+            commands->add(i, offset);
     };
 
     bool rotate_right_around(Point2DF point) {
@@ -666,17 +896,14 @@ public:
         return false;
     }
 
-    int32_t get_collided_shape_id(Point2DF coord, Point2DF size) {
-        PrimitiveShape* shape = new Rectangle;
-        shape->set_coordinate(Point2DF(coord));
-        shape->set_size(size);
+    //first own shape overlapping any of the layered shapes, -1 if none does
+    int32_t get_collided_shape_id(CompositeShape* layered, Contact* contact) {
         for (size_t it = 0; it < this->_shapes.size(); it++) {
-            if (this->_shapes.at(it)->is_collided_with_shape(shape) == true) {
-                delete shape;
-                return it;
+            for (auto shape : layered->_shapes) {
+                if (this->_shapes.at(it)->is_collided_with_shape(shape, contact) == true)
+                    return it;
             }
         }
-        delete shape;
         return -1;
     }
 
@@ -699,17 +926,6 @@ enum NormalDirection {
     NORMAL_LEFT
 };
 
-enum CollideDirection {
-    COLLIDE_UP,
-    COLLIDE_RIGHT,
-    COLLIDE_DOWN,
-    COLLIDE_LEFT,
-    COLLIDE_UP_RIGHT,
-    COLLIDE_UP_LEFT,
-    COLLIDE_DOWN_RIGHT,
-    COLLIDE_DOWN_LEFT
-};
-
 
 struct Body2D {
 public:
@@ -732,7 +948,14 @@ public:
     }
     virtual ~Body2D() { delete _compShape; };
     virtual void init() = 0;
-    void draw() { _compShape->draw(); };
+    //alpha - 0 records the state before the last act(), 1 the current one
+    void record(RenderCommandList* commands, float alpha) {
+        _compShape->record(commands, get_draw_offset(alpha));
+    };
+    Point2DF get_draw_offset(float alpha) {
+        return (this->_previousCoordinate - this->_coordinate) * (1.0f - alpha);
+    };
+    void store_previous_state() { this->_previousCoordinate = this->_coordinate; };
     virtual void act(float dt) = 0;
 
     void add_shape(Rectangle shape) {
@@ -890,6 +1113,8 @@ public:
 
         this->_compShape->move_on(Point2DF(direct.get_x(), direct.get_y()));
         this->_coordinate = Point2DF(this->get_coordinate() + tmpPoint);
+        //teleport, nothing to interpolate
+        this->store_previous_state();
         return true;
     };
 
@@ -927,37 +1152,19 @@ public:
         return ((body->_collisionLayer & this->get_collision_mask()) != 0x00) ? true : false;
     }
 
+    //bounds overlap on both axes, the cheap test before the shapes are compared
     bool is_box_collided(Body2D* body) {
         Point2DF maskedBodyTopLeft = body->get_coordinate();
         Point2DF maskedBodyBottomRight = body->get_coordinate() + body->get_size();
         Point2DF layeredBodyTopLeft = this->get_coordinate();
         Point2DF layeredBodyBottomRight = this->get_coordinate() + this->get_size();
 
-        bool leftUpInnerX = ((maskedBodyTopLeft.get_x() < layeredBodyTopLeft.get_x())
-            && (layeredBodyTopLeft.get_x() < maskedBodyBottomRight.get_x())) ? true : false;
-
-        bool leftUpInnerY = ((maskedBodyTopLeft.get_y() < layeredBodyTopLeft.get_y())
-            && (layeredBodyTopLeft.get_y() < maskedBodyBottomRight.get_y())) ? true : false;
-
-        bool rightBottomInnerX = ((maskedBodyTopLeft.get_x() < layeredBodyBottomRight.get_x())
-            && (layeredBodyBottomRight.get_x() < maskedBodyBottomRight.get_x())) ? true : false;
-
-        bool rightBottomInnerY = ((maskedBodyTopLeft.get_y() < layeredBodyBottomRight.get_y())
-            && (layeredBodyBottomRight.get_y() < maskedBodyBottomRight.get_y())) ? true : false;
-
-        bool pointLeftUpInner = (leftUpInnerX && leftUpInnerY == true) ? true : false;
-        bool pointLeftBottomInner = (leftUpInnerX && rightBottomInnerY == true) ? true : false;
-        bool pointRightUpInner = (rightBottomInnerX && leftUpInnerY == true) ? true : false;
-        bool pointRightBottomInner = (rightBottomInnerX && rightBottomInnerY == true) ? true : false;
-
-
-        if (pointLeftUpInner || pointLeftBottomInner || pointRightUpInner || pointRightBottomInner)
-            return true;
-
-        return false;
+        return (maskedBodyTopLeft.get_x() < layeredBodyBottomRight.get_x()) && (layeredBodyTopLeft.get_x() < maskedBodyBottomRight.get_x())
+            && (maskedBodyTopLeft.get_y() < layeredBodyBottomRight.get_y()) && (layeredBodyTopLeft.get_y() < maskedBodyBottomRight.get_y());
     }
-    int32_t get_collided_shape_id(Body2D* body) {
-        return this->_compShape->get_collided_shape_id(body->get_coordinate(), body->get_size());
+    //first own shape touching a shape of body, which is the layered one; -1 if none does
+    int32_t get_collided_shape_id(Body2D* body, Contact* contact) {
+        return this->_compShape->get_collided_shape_id(body->get_compShape(), contact);
     }
 
     void set_direction(Point2DF newDir) { _direction = newDir; }
@@ -972,49 +1179,27 @@ public:
 
     bool is_deletable() { return this->_deletable; }
 
-    virtual void collision_signal(std::string operationName, int32_t shape_id) {};
+    //static bodies never move, they are drawn once into the background layer
+    virtual bool is_static() { return false; }
 
-    virtual void collision_act(CollideDirection direction, Body2D* maskedBody, int32_t shape_id) {};
+    virtual void collision_signal(std::string operationName, int32_t shape_id) {};
 
-    void procedure_collision(Body2D* maskedBody, int32_t shape_id) {
-        Point2DF maskedBodyTopLeft = maskedBody->get_compShape()->get_coordinate_of_shape_at(shape_id);
-        Point2DF maskedBodyBottomRight = maskedBody->get_compShape()->get_coordinate_of_shape_at(shape_id)
-            + maskedBody->get_compShape()->get_size_of_shape_at(shape_id);
+    virtual void collision_act(const Contact& contact, Body2D* maskedBody, int32_t shape_id) {};
 
-        Point2DF layeredBodyTopLeft = this->get_coordinate();
-        Point2DF layeredBodyBottomRight = this->get_coordinate() + this->get_size();
+    void procedure_collision(Body2D* maskedBody, int32_t shape_id, const Contact& contact) {
+        this->collision_act(contact, maskedBody, shape_id);
+    }
 
-        bool leftUpInnerX = ((maskedBodyTopLeft.get_x() < layeredBodyTopLeft.get_x())
-            && (layeredBodyTopLeft.get_x() < maskedBodyBottomRight.get_x())) ? true : false;
-        bool leftUpInnerY = ((maskedBodyTopLeft.get_y() < layeredBodyTopLeft.get_y())
-            && (layeredBodyTopLeft.get_y() < maskedBodyBottomRight.get_y())) ? true : false;
-        bool rightBottomInnerX = ((maskedBodyTopLeft.get_x() < layeredBodyBottomRight.get_x())
-            && (layeredBodyBottomRight.get_x() < maskedBodyBottomRight.get_x())) ? true : false;
-        bool rightBottomInnerY = ((maskedBodyTopLeft.get_y() < layeredBodyBottomRight.get_y())
-            && (layeredBodyBottomRight.get_y() < maskedBodyBottomRight.get_y())) ? true : false;
-
-        bool pointLeftUpInner = (leftUpInnerX && leftUpInnerY == true) ? true : false;
-        bool pointLeftBottomInner = (rightBottomInnerX && leftUpInnerY == true) ? true : false;
-        bool pointRightUpInner = (leftUpInnerX && rightBottomInnerY == true) ? true : false;
-        bool pointRightBottomInner = (rightBottomInnerX && rightBottomInnerY == true) ? true : false;
-
-
-        if (pointLeftUpInner && pointRightUpInner)
-            this->collision_act(CollideDirection::COLLIDE_UP, maskedBody, shape_id);
-        else if (pointLeftUpInner && pointLeftBottomInner)
-            this->collision_act(CollideDirection::COLLIDE_LEFT, maskedBody, shape_id);
-        else if (pointRightUpInner && pointRightBottomInner)
-            this->collision_act(CollideDirection::COLLIDE_RIGHT, maskedBody, shape_id);
-        else if (pointRightBottomInner && pointLeftBottomInner)
-            this->collision_act(CollideDirection::COLLIDE_DOWN, maskedBody, shape_id);
-        else if (pointRightBottomInner)
-            this->collision_act(CollideDirection::COLLIDE_DOWN_RIGHT, maskedBody, shape_id);
-        else if (pointLeftBottomInner)
-            this->collision_act(CollideDirection::COLLIDE_DOWN_LEFT, maskedBody, shape_id);
-        else if (pointLeftUpInner)
-            this->collision_act(CollideDirection::COLLIDE_UP_LEFT, maskedBody, shape_id);
-        else if (pointRightUpInner)
-            this->collision_act(CollideDirection::COLLIDE_UP_RIGHT, maskedBody, shape_id);
+    //move to the opposite border for a body touching a border on the contact side
+    Point2DF get_wrap_units(const Contact& contact) {
+        if (std::fabs(contact.normal.get_y()) > std::fabs(contact.normal.get_x())) {
+            if (contact.normal.get_y() > 0)
+                return Point2DF(0, -(this->get_coordinate().get_y() - Constants::border_width - 1));
+            return Point2DF(0, (SCREEN_WIDTH - 2 * Constants::border_width - this->get_size().get_y()));
+        }
+        if (contact.normal.get_x() < 0)
+            return Point2DF((SCREEN_HEIGHT - 2 * Constants::border_width - this->get_size().get_x()), 0);
+        return Point2DF(-(this->get_coordinate().get_x() - Constants::border_width - 1), 0);
     }
     virtual Point2DF get_start_point() { return Point2DF(0, 0); }
 
@@ -1022,6 +1207,7 @@ public:
 
 private:
     Point2DF _coordinate;
+    Point2DF _previousCoordinate;
     Point2DF _size;
     CompositeShape* _compShape;
     NormalDirection _normalDir;
@@ -1045,6 +1231,7 @@ struct BordersLeft : Body2D {
     };
 
     void act(float dt) { };
+    bool is_static() { return true; };
 };
 struct BordersRight : Body2D {
     void init() {
@@ -1057,6 +1244,7 @@ struct BordersRight : Body2D {
     };
 
     void act(float dt) { };
+    bool is_static() { return true; };
 };
 struct BordersTop : Body2D {
     void init() {
@@ -1069,6 +1257,7 @@ struct BordersTop : Body2D {
     };
 
     void act(float dt) { };
+    bool is_static() { return true; };
 };
 struct BordersBottom : Body2D {
     void init() {
@@ -1081,6 +1270,7 @@ struct BordersBottom : Body2D {
     };
 
     void act(float dt) { };
+    bool is_static() { return true; };
 };
 
 struct Ship : Body2D {
@@ -1146,21 +1336,11 @@ struct Ship : Body2D {
         if (moveUnits != Point2DF(0.0, 0.0))
             this->move_on(moveUnits);
     };
-    void collision_act(CollideDirection direction, Body2D* maskedBody, int32_t shape_id) {
+    void collision_act(const Contact& contact, Body2D* maskedBody, int32_t shape_id) {
         Point2DF moveUnits(0, 0);
         uint16_t mask = this->get_collision_layer() & maskedBody->get_collision_mask();
         if ((mask == 0x01)) {
-            if ((direction == CollideDirection::COLLIDE_RIGHT) || (direction == CollideDirection::COLLIDE_LEFT))
-                if (direction == CollideDirection::COLLIDE_RIGHT)
-                    moveUnits = Point2DF(0, -(this->get_coordinate().get_y() - Constants::border_width - 1));
-                else
-                    moveUnits = Point2DF(0, (SCREEN_WIDTH -  2 * Constants::border_width - this->get_size().get_y()));
-
-            if ((direction == CollideDirection::COLLIDE_UP) || (direction == CollideDirection::COLLIDE_DOWN))
-                if (direction == CollideDirection::COLLIDE_UP)
-                    moveUnits = Point2DF((SCREEN_HEIGHT - 2 * Constants::border_width - this->get_size().get_x()), 0);
-                else
-                    moveUnits = Point2DF(-(this->get_coordinate().get_x() - Constants::border_width - 1), 0);
+            moveUnits = this->get_wrap_units(contact);
         }
         if ((mask & 0x1C) != 0x00){
             mark:
@@ -1196,14 +1376,12 @@ struct Projectile : Body2D {
         if (moveUnits != Point2DF(0.0, 0.0))
             this->move_on(moveUnits);
     };
-    void collision_act(CollideDirection direction, Body2D* maskedBody, int32_t shape_id) {
+    void collision_act(const Contact& contact, Body2D* maskedBody, int32_t shape_id) {
         Point2DF moveUnits(0, 0);
         uint16_t mask = this->get_collision_layer() & maskedBody->get_collision_mask();
 
         if ((mask == 0x01))
-            if ((direction == CollideDirection::COLLIDE_RIGHT) || (direction == CollideDirection::COLLIDE_LEFT) 
-                    || (direction == CollideDirection::COLLIDE_UP) || (direction == CollideDirection::COLLIDE_DOWN))
-                this->delete_request();
+            this->delete_request();
     };
 };
 
@@ -1226,24 +1404,14 @@ struct Asteroid1 : Body2D {
             this->move_on(moveUnits);
     };
 
-    void collision_act(CollideDirection direction, Body2D* maskedBody, int32_t shape_id) {
+    void collision_act(const Contact& contact, Body2D* maskedBody, int32_t shape_id) {
         Point2DF moveUnits(0, 0);
         uint16_t mask = this->get_collision_layer() & maskedBody->get_collision_mask();
         if ((mask == 0x02))
             this->delete_request();
 
         if ((mask == 0x01)) {
-            if ((direction == CollideDirection::COLLIDE_RIGHT) || (direction == CollideDirection::COLLIDE_LEFT))
-                if (direction == CollideDirection::COLLIDE_RIGHT)
-                    moveUnits = Point2DF(0, -(this->get_coordinate().get_y() - Constants::border_width - 1));
-                else
-                    moveUnits = Point2DF(0, (SCREEN_WIDTH - 2 * Constants::border_width - this->get_size().get_y()));
-
-            if ((direction == CollideDirection::COLLIDE_UP) || (direction == CollideDirection::COLLIDE_DOWN))
-                if (direction == CollideDirection::COLLIDE_UP)
-                    moveUnits = Point2DF((SCREEN_HEIGHT - 2 * Constants::border_width - this->get_size().get_x()), 0);
-                else
-                    moveUnits = Point2DF(-(this->get_coordinate().get_x() - Constants::border_width - 1), 0);
+            moveUnits = this->get_wrap_units(contact);
 
             this->move_immedeatly(moveUnits);
         }
@@ -1268,24 +1436,14 @@ struct Asteroid2 : Body2D {
             this->move_on(moveUnits);
     };
 
-    void collision_act(CollideDirection direction, Body2D* maskedBody, int32_t shape_id) {
+    void collision_act(const Contact& contact, Body2D* maskedBody, int32_t shape_id) {
         Point2DF moveUnits(0, 0);
         uint16_t mask = this->get_collision_layer() & maskedBody->get_collision_mask();
         if ((mask == 0x02))
                 this->delete_request();
 
         if ((mask == 0x01)) {
-            if ((direction == CollideDirection::COLLIDE_RIGHT) || (direction == CollideDirection::COLLIDE_LEFT))
-                if (direction == CollideDirection::COLLIDE_RIGHT)
-                    moveUnits = Point2DF(0, -(this->get_coordinate().get_y() - Constants::border_width - 1));
-                else
-                    moveUnits = Point2DF(0, (SCREEN_WIDTH - 2 * Constants::border_width - this->get_size().get_y()));
-
-            if ((direction == CollideDirection::COLLIDE_UP) || (direction == CollideDirection::COLLIDE_DOWN))
-                if (direction == CollideDirection::COLLIDE_UP)
-                    moveUnits = Point2DF((SCREEN_HEIGHT - 2 * Constants::border_width - this->get_size().get_x()), 0);
-                else
-                    moveUnits = Point2DF(-(this->get_coordinate().get_x() - Constants::border_width - 1), 0);
+            moveUnits = this->get_wrap_units(contact);
 
             this->move_immedeatly(moveUnits);
         }
@@ -1311,24 +1469,14 @@ struct Asteroid3 : Body2D {
             this->move_on(moveUnits);
     };
 
-    void collision_act(CollideDirection direction, Body2D* maskedBody, int32_t shape_id) {
+    void collision_act(const Contact& contact, Body2D* maskedBody, int32_t shape_id) {
         Point2DF moveUnits(0, 0);
         uint16_t mask = this->get_collision_layer() & maskedBody->get_collision_mask();
         if ((mask == 0x02))
             this->delete_request();
 
         if ((mask == 0x01)) {
-            if ((direction == CollideDirection::COLLIDE_RIGHT) || (direction == CollideDirection::COLLIDE_LEFT))
-                if (direction == CollideDirection::COLLIDE_RIGHT)
-                    moveUnits = Point2DF(0, -(this->get_coordinate().get_y() - Constants::border_width - 1));
-                else
-                    moveUnits = Point2DF(0, (SCREEN_WIDTH - 2 * Constants::border_width - this->get_size().get_y()));
-
-            if ((direction == CollideDirection::COLLIDE_UP) || (direction == CollideDirection::COLLIDE_DOWN))
-                if (direction == CollideDirection::COLLIDE_UP) 
-                    moveUnits = Point2DF((SCREEN_HEIGHT - 2 * Constants::border_width - this->get_size().get_x()), 0);
-                else
-                    moveUnits = Point2DF(-(this->get_coordinate().get_x() - Constants::border_width - 1), 0);
+            moveUnits = this->get_wrap_units(contact);
 
             this->move_immedeatly(moveUnits);
         }
@@ -1356,8 +1504,9 @@ struct ShipIcon1 : Body2D {
 
     void act(float dt) {
     };
-    void collision_act(CollideDirection direction, Body2D* maskedBody, int32_t shape_id) {
+    void collision_act(const Contact& contact, Body2D* maskedBody, int32_t shape_id) {
     };
+    bool is_static() { return true; };
 };
 
 struct ShipIcon2 : Body2D {
@@ -1381,8 +1530,9 @@ struct ShipIcon2 : Body2D {
 
     void act(float dt) {
     };
-    void collision_act(CollideDirection direction, Body2D* maskedBody, int32_t shape_id) {
+    void collision_act(const Contact& contact, Body2D* maskedBody, int32_t shape_id) {
     };
+    bool is_static() { return true; };
 };
 
 struct ShipIcon3 : Body2D {
@@ -1406,8 +1556,805 @@ struct ShipIcon3 : Body2D {
 
     void act(float dt) {
     };
-    void collision_act(CollideDirection direction, Body2D* maskedBody, int32_t shape_id) {
+    void collision_act(const Contact& contact, Body2D* maskedBody, int32_t shape_id) {
+    };
+    bool is_static() { return true; };
+};
+
+//bodies grouped by their layer and mask: the few groups are matched against each other once per
+//tick, both ways at a time, and every body gets the ordered list of bodies it can collide with at
+//all. Bodies with neither layer nor mask join no group
+struct LayerBuckets
+{
+public:
+    void update(const std::vector<Body2D*>& bodies) {
+        //groups left empty by the previous tick are dropped, the rest keep their storage
+        this->_buckets.erase(std::remove_if(this->_buckets.begin(), this->_buckets.end(),
+            [](const Bucket& bucket) { return bucket.bodies.empty(); }), this->_buckets.end());
+        for (auto& bucket : this->_buckets) {
+            bucket.bodies.clear();
+            bucket.masked.clear();
+            bucket.layered.clear();
+            bucket.maskedBy.clear();
+            bucket.layeredBy.clear();
+        }
+
+        this->_bucketOf.resize(bodies.size());
+        for (uint32_t i = 0; i < bodies.size(); i++) {
+            const uint16_t layer = bodies[i]->get_collision_layer();
+            const uint16_t mask = bodies[i]->get_collision_mask();
+            if ((layer == 0x00) && (mask == 0x00)) {
+                this->_bucketOf[i] = UINT32_MAX;
+                continue;
+            }
+            uint32_t id = 0;
+            while ((id < this->_buckets.size()) && ((this->_buckets[id].layer != layer) || (this->_buckets[id].mask != mask)))
+                id++;
+            if (id == this->_buckets.size()) {
+                this->_buckets.emplace_back();
+                this->_buckets[id].layer = layer;
+                this->_buckets[id].mask = mask;
+            }
+            this->_buckets[id].bodies.push_back(i);
+            this->_bucketOf[i] = id;
+        }
+
+        for (uint32_t a = 0; a < this->_buckets.size(); a++) {
+            for (uint32_t b = a; b < this->_buckets.size(); b++) {
+                Bucket& first = this->_buckets[a];
+                Bucket& second = this->_buckets[b];
+                if ((second.mask & first.layer) != 0x00) {
+                    second.maskedBy.push_back(a);
+                    first.layeredBy.push_back(b);
+                }
+                if ((a != b) && ((first.mask & second.layer) != 0x00)) {
+                    first.maskedBy.push_back(b);
+                    second.layeredBy.push_back(a);
+                }
+            }
+        }
+
+        //visited in order, so the lists come out sorted
+        for (uint32_t i = 0; i < bodies.size(); i++) {
+            if (this->_bucketOf[i] == UINT32_MAX)
+                continue;
+            const Bucket& bucket = this->_buckets[this->_bucketOf[i]];
+            for (uint32_t id : bucket.maskedBy)
+                this->_buckets[id].masked.push_back(i);
+            for (uint32_t id : bucket.layeredBy)
+                this->_buckets[id].layered.push_back(i);
+        }
+    };
+
+    //bodies whose mask takes the layer of body, body itself included when it collides with its own kind
+    const std::vector<uint32_t>& get_masked(uint32_t body) {
+        return (this->_bucketOf[body] == UINT32_MAX) ? this->_none : this->_buckets[this->_bucketOf[body]].masked;
+    };
+
+    //bodies whose layer is taken by the mask of body
+    const std::vector<uint32_t>& get_layered(uint32_t body) {
+        return (this->_bucketOf[body] == UINT32_MAX) ? this->_none : this->_buckets[this->_bucketOf[body]].layered;
+    };
+
+private:
+    struct Bucket {
+        uint16_t layer;
+        uint16_t mask;
+        std::vector<uint32_t> bodies;
+        std::vector<uint32_t> masked;
+        std::vector<uint32_t> layered;
+        std::vector<uint32_t> maskedBy;
+        std::vector<uint32_t> layeredBy;
     };
+
+    std::vector<Bucket> _buckets;
+    std::vector<uint32_t> _bucketOf;
+    const std::vector<uint32_t> _none;
+};
+
+//uniform grid broadphase: every tick the bodies are binned into square cells by their bounds,
+//only bodies sharing a cell become candidate pairs. Bodies spanning most of the screen would
+//land in every cell, they are kept aside and paired with everything
+struct CollisionGrid
+{
+public:
+    //fills pairs with (layered, masked) indices of bodies whose bounds overlap, ordered the way
+    //a double loop over bodies visits them
+    void find_pairs(const std::vector<Body2D*>& bodies, std::vector<std::pair<uint32_t, uint32_t>>& pairs) {
+        pairs.clear();
+        this->_rows = SCREEN_HEIGHT / Constants::collision_cell_size + 1;
+        this->_columns = SCREEN_WIDTH / Constants::collision_cell_size + 1;
+        this->_cellStart.assign(this->_rows * this->_columns + 1, 0);
+        this->_bounds.resize(bodies.size());
+        this->_large.clear();
+
+        //counting sort of the (cell, body) entries by cell
+        for (uint32_t i = 0; i < bodies.size(); i++) {
+            this->_bounds[i] = this->get_bounds(bodies[i]);
+            const BodyBounds& bounds = this->_bounds[i];
+            if (bounds.large) {
+                this->_large.push_back(i);
+                continue;
+            }
+            for (int row = bounds.firstRow; row <= bounds.lastRow; row++)
+                for (int column = bounds.firstColumn; column <= bounds.lastColumn; column++)
+                    this->_cellStart[row * this->_columns + column + 1]++;
+        }
+        for (size_t cell = 1; cell < this->_cellStart.size(); cell++)
+            this->_cellStart[cell] += this->_cellStart[cell - 1];
+
+        this->_cellFill.assign(this->_cellStart.begin(), this->_cellStart.end() - 1);
+        this->_entries.resize(this->_cellStart.back());
+        for (uint32_t i = 0; i < bodies.size(); i++) {
+            const BodyBounds& bounds = this->_bounds[i];
+            if (bounds.large)
+                continue;
+            for (int row = bounds.firstRow; row <= bounds.lastRow; row++)
+                for (int column = bounds.firstColumn; column <= bounds.lastColumn; column++)
+                    this->_entries[this->_cellFill[row * this->_columns + column]++] = i;
+        }
+
+        for (int row = 0; row < this->_rows; row++) {
+            for (int column = 0; column < this->_columns; column++) {
+                const uint32_t cellFirst = this->_cellStart[row * this->_columns + column];
+                const uint32_t cellEnd = this->_cellStart[row * this->_columns + column + 1];
+                for (uint32_t a = cellFirst; a < cellEnd; a++) {
+                    for (uint32_t b = a + 1; b < cellEnd; b++) {
+                        const BodyBounds& first = this->_bounds[this->_entries[a]];
+                        const BodyBounds& second = this->_bounds[this->_entries[b]];
+                        //a pair sharing several cells is reported by the first of them only
+                        if ((row == std::max(first.firstRow, second.firstRow))
+                            && (column == std::max(first.firstColumn, second.firstColumn)))
+                            this->add_pair(this->_entries[a], this->_entries[b], pairs);
+                    }
+                }
+            }
+        }
+
+        for (uint32_t large : this->_large) {
+            for (uint32_t i = 0; i < bodies.size(); i++) {
+                //two large bodies are paired once
+                if ((i != large) && this->_bounds[i].collides && (!this->_bounds[i].large || (i > large)))
+                    this->add_pair(large, i, pairs);
+            }
+        }
+        std::sort(pairs.begin(), pairs.end());
+    };
+
+private:
+    struct BodyBounds {
+        float top;
+        float left;
+        float bottom;
+        float right;
+        int firstRow;
+        int firstColumn;
+        int lastRow;
+        int lastColumn;
+        uint16_t layer;
+        uint16_t mask;
+        bool collides;
+        bool large;
+    };
+
+    void add_pair(uint32_t i, uint32_t j, std::vector<std::pair<uint32_t, uint32_t>>& pairs) {
+        const BodyBounds& first = this->_bounds[i];
+        const BodyBounds& second = this->_bounds[j];
+        const bool firstCollides = (second.mask & first.layer) != 0x00;
+        const bool secondCollides = (first.mask & second.layer) != 0x00;
+        if ((!firstCollides && !secondCollides)
+            || (first.top >= second.bottom) || (second.top >= first.bottom)
+            || (first.left >= second.right) || (second.left >= first.right))
+            return;
+
+        if (firstCollides)
+            pairs.push_back(std::make_pair(i, j));
+        if (secondCollides)
+            pairs.push_back(std::make_pair(j, i));
+    };
+
+    BodyBounds get_bounds(Body2D* body) {
+        BodyBounds bounds;
+        const Point2DF topLeft = body->get_coordinate();
+        const Point2DF bottomRight = body->get_coordinate() + body->get_size();
+        bounds.top = topLeft.get_x();
+        bounds.left = topLeft.get_y();
+        bounds.bottom = bottomRight.get_x();
+        bounds.right = bottomRight.get_y();
+        bounds.layer = body->get_collision_layer();
+        bounds.mask = body->get_collision_mask();
+
+        //bodies which neither collide nor are collided with take no cells
+        bounds.collides = (bounds.layer != 0x00) || (bounds.mask != 0x00);
+        if (!bounds.collides) {
+            bounds.firstRow = bounds.firstColumn = 0;
+            bounds.lastRow = bounds.lastColumn = -1;
+            bounds.large = false;
+            return bounds;
+        }
+        bounds.firstRow = this->get_cell(bounds.top, this->_rows);
+        bounds.firstColumn = this->get_cell(bounds.left, this->_columns);
+        bounds.lastRow = this->get_cell(bounds.bottom, this->_rows);
+        bounds.lastColumn = this->get_cell(bounds.right, this->_columns);
+        bounds.large = (bounds.lastRow - bounds.firstRow + 1) * (bounds.lastColumn - bounds.firstColumn + 1)
+            > Constants::collision_large_cells;
+        return bounds;
+    };
+
+    int get_cell(float coordinate, int count) {
+        const int cell = int(coordinate) / Constants::collision_cell_size;
+        return std::min(std::max(cell, 0), count - 1);
+    };
+
+    int _rows = 0;
+    int _columns = 0;
+    std::vector<BodyBounds> _bounds;
+    std::vector<uint32_t> _large;
+    std::vector<uint32_t> _cellStart;
+    std::vector<uint32_t> _cellFill;
+    std::vector<uint32_t> _entries;
+};
+
+//sweep and prune broadphase: the bounds of every body are kept as min/max endpoints in two lists,
+//one sorted by rows and one by columns. Bodies move little between ticks, so insertion sort puts
+//the lists back in order in nearly linear time, and every min passing a max on the way adds or
+//removes an overlapping pair. Only pairs where one body can collide with the other are kept
+struct SweepAndPrune
+{
+public:
+    //fills pairs like CollisionGrid::find_pairs
+    void find_pairs(const std::vector<Body2D*>& bodies, std::vector<std::pair<uint32_t, uint32_t>>& pairs) {
+        this->_tick++;
+        for (uint32_t i = 0; i < bodies.size(); i++) {
+            Body2D* body = bodies[i];
+            if ((body->get_collision_layer() == 0x00) && (body->get_collision_mask() == 0x00))
+                continue;
+
+            //a body which changed its layer or mask gets a new proxy, the old one goes stale
+            auto found = this->_proxyIds.find(body);
+            const uint32_t id = ((found != this->_proxyIds.end())
+                && (this->_proxies[found->second].layer == body->get_collision_layer())
+                && (this->_proxies[found->second].mask == body->get_collision_mask()))
+                ? found->second : this->add_proxy(body);
+            Proxy& proxy = this->_proxies[id];
+            const Point2DF topLeft = body->get_coordinate();
+            const Point2DF bottomRight = body->get_coordinate() + body->get_size();
+            proxy.index = i;
+            proxy.tick = this->_tick;
+            proxy.min[0] = topLeft.get_x();
+            proxy.min[1] = topLeft.get_y();
+            proxy.max[0] = bottomRight.get_x();
+            proxy.max[1] = bottomRight.get_y();
+        }
+        this->remove_stale_proxies();
+        this->sort_axis(0);
+        this->sort_axis(1);
+
+        pairs.clear();
+        for (uint64_t key : this->_pairs) {
+            const Proxy& first = this->_proxies[uint32_t(key >> 32)];
+            const Proxy& second = this->_proxies[uint32_t(key)];
+            //touching bounds stay in the set, only overlapping ones are reported
+            if ((first.min[0] >= second.max[0]) || (second.min[0] >= first.max[0])
+                || (first.min[1] >= second.max[1]) || (second.min[1] >= first.max[1]))
+                continue;
+
+            if ((second.mask & first.layer) != 0x00)
+                pairs.push_back(std::make_pair(first.index, second.index));
+            if ((first.mask & second.layer) != 0x00)
+                pairs.push_back(std::make_pair(second.index, first.index));
+        }
+        std::sort(pairs.begin(), pairs.end());
+    };
+
+private:
+    struct Proxy {
+        Body2D* body;
+        uint16_t layer;
+        uint16_t mask;
+        uint32_t index;
+        uint32_t tick;
+        float min[2];
+        float max[2];
+    };
+
+    struct Endpoint {
+        float value;
+        uint32_t proxy;
+        bool isMax;
+    };
+
+    //at equal values mins go first, so the order of the endpoints tells the same as comparing
+    //the values with <=
+    static bool is_before(const Endpoint& endpoint, const Endpoint& other) {
+        return (endpoint.value < other.value) || ((endpoint.value == other.value) && !endpoint.isMax && other.isMax);
+    };
+
+    static uint64_t pair_key(uint32_t first, uint32_t second) {
+        return (first < second) ? ((uint64_t(first) << 32) | second) : ((uint64_t(second) << 32) | first);
+    };
+
+    bool is_overlapped(uint32_t first, uint32_t second) {
+        const Proxy& a = this->_proxies[first];
+        const Proxy& b = this->_proxies[second];
+        if (((a.mask & b.layer) == 0x00) && ((b.mask & a.layer) == 0x00))
+            return false;
+        return (a.min[0] <= b.max[0]) && (b.min[0] <= a.max[0]) && (a.min[1] <= b.max[1]) && (b.min[1] <= a.max[1]);
+    };
+
+    //new endpoints go to the end of the lists, sorting them in adds their pairs
+    uint32_t add_proxy(Body2D* body) {
+        uint32_t id;
+        if (!this->_freeIds.empty()) {
+            id = this->_freeIds.back();
+            this->_freeIds.pop_back();
+        }
+        else {
+            id = uint32_t(this->_proxies.size());
+            this->_proxies.push_back(Proxy());
+        }
+        this->_proxies[id].body = body;
+        this->_proxies[id].layer = body->get_collision_layer();
+        this->_proxies[id].mask = body->get_collision_mask();
+        this->_proxyIds[body] = id;
+        for (int axis = 0; axis < 2; axis++) {
+            this->_endpoints[axis].push_back({ 0.0f, id, false });
+            this->_endpoints[axis].push_back({ 0.0f, id, true });
+        }
+        return id;
+    };
+
+    //drops the proxies of bodies which were deleted or stopped colliding
+    void remove_stale_proxies() {
+        bool removed = false;
+        for (uint32_t id = 0; id < this->_proxies.size(); id++) {
+            Proxy& proxy = this->_proxies[id];
+            if ((proxy.body == NULL) || (proxy.tick == this->_tick))
+                continue;
+
+            auto found = this->_proxyIds.find(proxy.body);
+            if ((found != this->_proxyIds.end()) && (found->second == id))
+                this->_proxyIds.erase(found);
+            proxy.body = NULL;
+            this->_freeIds.push_back(id);
+            removed = true;
+        }
+        if (!removed)
+            return;
+
+        for (int axis = 0; axis < 2; axis++) {
+            std::vector<Endpoint>& endpoints = this->_endpoints[axis];
+            endpoints.erase(std::remove_if(endpoints.begin(), endpoints.end(),
+                [this](const Endpoint& endpoint) { return this->_proxies[endpoint.proxy].body == NULL; }), endpoints.end());
+        }
+        for (auto it = this->_pairs.begin(); it != this->_pairs.end();) {
+            if ((this->_proxies[uint32_t(*it >> 32)].body == NULL) || (this->_proxies[uint32_t(*it)].body == NULL))
+                it = this->_pairs.erase(it);
+            else
+                ++it;
+        }
+    };
+
+    void sort_axis(int axis) {
+        std::vector<Endpoint>& endpoints = this->_endpoints[axis];
+        for (auto& endpoint : endpoints) {
+            const Proxy& proxy = this->_proxies[endpoint.proxy];
+            endpoint.value = endpoint.isMax ? proxy.max[axis] : proxy.min[axis];
+        }
+
+        for (size_t i = 1; i < endpoints.size(); i++) {
+            const Endpoint moving = endpoints[i];
+            size_t j = i;
+            for (; (j > 0) && is_before(moving, endpoints[j - 1]); j--) {
+                const Endpoint& passed = endpoints[j - 1];
+                if (!moving.isMax && passed.isMax) {
+                    if (this->is_overlapped(moving.proxy, passed.proxy))
+                        this->_pairs.insert(pair_key(moving.proxy, passed.proxy));
+                }
+                else if (moving.isMax && !passed.isMax)
+                    this->_pairs.erase(pair_key(moving.proxy, passed.proxy));
+                endpoints[j] = passed;
+            }
+            endpoints[j] = moving;
+        }
+    };
+
+    uint32_t _tick = 0;
+    std::vector<Proxy> _proxies;
+    std::vector<uint32_t> _freeIds;
+    std::unordered_map<Body2D*, uint32_t> _proxyIds;
+    std::vector<Endpoint> _endpoints[2];
+    std::unordered_set<uint64_t> _pairs;
+};
+
+//dynamic bounding box tree: every colliding body is a leaf holding its bounds grown by a margin,
+//so a body moving a little keeps its leaf, and inner nodes bound their two children. Leaves are
+//inserted next to the sibling which grows the tree the least and rotations keep it balanced.
+//Every node also knows the layers and masks below it, so queries skip the subtrees holding nothing
+//they can collide with. Besides the broadphase pairs it answers region and ray queries
+struct AabbTree
+{
+public:
+    //brings the leaves in line with the bodies, the queries report indices into bodies
+    void update(const std::vector<Body2D*>& bodies) {
+        this->_tick++;
+        for (uint32_t i = 0; i < bodies.size(); i++) {
+            Body2D* body = bodies[i];
+            if ((body->get_collision_layer() == 0x00) && (body->get_collision_mask() == 0x00))
+                continue;
+
+            const Point2DF topLeft = body->get_coordinate();
+            const Point2DF bottomRight = body->get_coordinate() + body->get_size();
+            const Box tight = { topLeft.get_x(), topLeft.get_y(), bottomRight.get_x(), bottomRight.get_y() };
+
+            //a body which changed its layer or mask gets a new leaf, the old one goes stale
+            auto found = this->_leaves.find(body);
+            int32_t leaf = ((found != this->_leaves.end())
+                && (this->_nodes[found->second].layers == body->get_collision_layer())
+                && (this->_nodes[found->second].masks == body->get_collision_mask()))
+                ? found->second : -1;
+            if (leaf == -1) {
+                leaf = this->allocate_node();
+                Node& node = this->_nodes[leaf];
+                node.body = body;
+                node.layers = body->get_collision_layer();
+                node.masks = body->get_collision_mask();
+                node.fat = grow(tight);
+                this->insert_leaf(leaf);
+                this->_leaves[body] = leaf;
+            }
+            else if (!contains(this->_nodes[leaf].fat, tight)) {
+                this->remove_leaf(leaf);
+                this->_nodes[leaf].fat = grow(tight);
+                this->insert_leaf(leaf);
+            }
+            Node& node = this->_nodes[leaf];
+            node.tight = tight;
+            node.index = i;
+            node.tick = this->_tick;
+        }
+
+        //leaves of bodies which were deleted or stopped colliding
+        for (int32_t id = 0; id < int32_t(this->_nodes.size()); id++) {
+            Node& node = this->_nodes[id];
+            if ((node.body == NULL) || (node.tick == this->_tick))
+                continue;
+
+            auto found = this->_leaves.find(node.body);
+            if ((found != this->_leaves.end()) && (found->second == id))
+                this->_leaves.erase(found);
+            this->remove_leaf(id);
+            this->free_node(id);
+        }
+    };
+
+    //fills pairs like CollisionGrid::find_pairs
+    void find_pairs(const std::vector<Body2D*>& bodies, std::vector<std::pair<uint32_t, uint32_t>>& pairs) {
+        this->update(bodies);
+        pairs.clear();
+        for (int32_t id = 0; id < int32_t(this->_nodes.size()); id++) {
+            const Node& leaf = this->_nodes[id];
+            if (leaf.body == NULL)
+                continue;
+
+            this->_stack.clear();
+            this->push(this->_root);
+            while (!this->_stack.empty()) {
+                const Node& node = this->_nodes[this->_stack.back()];
+                const int32_t current = this->_stack.back();
+                this->_stack.pop_back();
+                if ((((leaf.masks & node.layers) == 0x00) && ((node.masks & leaf.layers) == 0x00))
+                    || !overlaps(node.fat, leaf.tight))
+                    continue;
+                if (!node.is_leaf()) {
+                    this->push(node.children[0]);
+                    this->push(node.children[1]);
+                    continue;
+                }
+                //every pair is met from both of its leaves, it is taken from the first body
+                if ((current == id) || (node.index < leaf.index) || !overlaps(node.tight, leaf.tight))
+                    continue;
+                if ((node.masks & leaf.layers) != 0x00)
+                    pairs.push_back(std::make_pair(leaf.index, node.index));
+                if ((leaf.masks & node.layers) != 0x00)
+                    pairs.push_back(std::make_pair(node.index, leaf.index));
+            }
+        }
+        std::sort(pairs.begin(), pairs.end());
+    };
+
+    //indices of the bodies on any of layers whose bounds overlap the region
+    void query_region(Point2DF topLeft, Point2DF bottomRight, uint16_t layers, std::vector<uint32_t>& indices) {
+        const Box region = { topLeft.get_x(), topLeft.get_y(), bottomRight.get_x(), bottomRight.get_y() };
+        indices.clear();
+        this->_stack.clear();
+        this->push(this->_root);
+        while (!this->_stack.empty()) {
+            const Node& node = this->_nodes[this->_stack.back()];
+            this->_stack.pop_back();
+            if (((node.layers & layers) == 0x00) || !overlaps(node.fat, region))
+                continue;
+            if (!node.is_leaf()) {
+                this->push(node.children[0]);
+                this->push(node.children[1]);
+            }
+            else if (overlaps(node.tight, region))
+                indices.push_back(node.index);
+        }
+    };
+
+    //index of the first body on any of layers whose bounds the ray from origin along direction
+    //enters within length pixels, -1 if there is none; a body holding origin is hit at distance 0
+    int32_t raycast(Point2DF origin, Point2DF direction, float length, uint16_t layers, float* distance) {
+        const float norm = std::sqrt(direction.get_x() * direction.get_x() + direction.get_y() * direction.get_y());
+        if (norm == 0.0f)
+            return -1;
+        const Ray ray = { origin.get_x(), origin.get_y(), direction.get_x() / norm, direction.get_y() / norm };
+
+        int32_t hit = -1;
+        float nearest = length;
+        this->_stack.clear();
+        this->push(this->_root);
+        while (!this->_stack.empty()) {
+            const Node& node = this->_nodes[this->_stack.back()];
+            this->_stack.pop_back();
+            if (((node.layers & layers) == 0x00) || (ray_distance(ray, node.fat, nearest) < 0.0f))
+                continue;
+            if (!node.is_leaf()) {
+                this->push(node.children[0]);
+                this->push(node.children[1]);
+                continue;
+            }
+            const float entry = ray_distance(ray, node.tight, nearest);
+            if ((entry >= 0.0f) && ((hit == -1) || (entry < nearest) || ((entry == nearest) && (int32_t(node.index) < hit)))) {
+                hit = node.index;
+                nearest = entry;
+            }
+        }
+        if ((hit != -1) && distance)
+            *distance = nearest;
+        return hit;
+    };
+
+private:
+    struct Box {
+        float top;
+        float left;
+        float bottom;
+        float right;
+    };
+
+    struct Ray {
+        float x;
+        float y;
+        float directionX;
+        float directionY;
+    };
+
+    struct Node {
+        Box fat;             //leaves: the body bounds grown by the margin, inner nodes: both children
+        Box tight;           //leaves: the body bounds
+        int32_t parent;      //next free node while the node is free
+        int32_t children[2]; //-1 for leaves
+        int32_t height;      //0 for leaves
+        uint16_t layers;     //leaves: the body layer and mask, inner nodes: all of them below
+        uint16_t masks;
+        Body2D* body;        //NULL unless the node is a leaf in use
+        uint32_t index;
+        uint32_t tick;
+
+        bool is_leaf() const { return this->children[0] == -1; };
+    };
+
+    static Box grow(const Box& box) {
+        const float margin = Constants::collision_tree_margin;
+        return { box.top - margin, box.left - margin, box.bottom + margin, box.right + margin };
+    };
+
+    static Box unite(const Box& first, const Box& second) {
+        return { std::min(first.top, second.top), std::min(first.left, second.left),
+            std::max(first.bottom, second.bottom), std::max(first.right, second.right) };
+    };
+
+    static float perimeter(const Box& box) {
+        return 2.0f * ((box.bottom - box.top) + (box.right - box.left));
+    };
+
+    static bool contains(const Box& outer, const Box& inner) {
+        return (outer.top <= inner.top) && (outer.left <= inner.left)
+            && (inner.bottom <= outer.bottom) && (inner.right <= outer.right);
+    };
+
+    static bool overlaps(const Box& first, const Box& second) {
+        return (first.top < second.bottom) && (second.top < first.bottom)
+            && (first.left < second.right) && (second.left < first.right);
+    };
+
+    //distance along the ray to where it enters the box (0 from inside), -1 if that is not within length
+    static float ray_distance(const Ray& ray, const Box& box, float length) {
+        float entry = 0.0f;
+        float exit = length;
+        const float origins[2] = { ray.x, ray.y };
+        const float directions[2] = { ray.directionX, ray.directionY };
+        const float lows[2] = { box.top, box.left };
+        const float highs[2] = { box.bottom, box.right };
+        for (int axis = 0; axis < 2; axis++) {
+            if (directions[axis] == 0.0f) {
+                if ((origins[axis] < lows[axis]) || (origins[axis] > highs[axis]))
+                    return -1.0f;
+                continue;
+            }
+            float near = (lows[axis] - origins[axis]) / directions[axis];
+            float far = (highs[axis] - origins[axis]) / directions[axis];
+            if (near > far)
+                std::swap(near, far);
+            entry = std::max(entry, near);
+            exit = std::min(exit, far);
+            if (entry > exit)
+                return -1.0f;
+        }
+        return entry;
+    };
+
+    void push(int32_t id) {
+        if (id != -1)
+            this->_stack.push_back(id);
+    };
+
+    int32_t allocate_node() {
+        int32_t id = this->_free;
+        if (id != -1)
+            this->_free = this->_nodes[id].parent;
+        else {
+            id = int32_t(this->_nodes.size());
+            this->_nodes.push_back(Node());
+        }
+        Node& node = this->_nodes[id];
+        node.parent = -1;
+        node.children[0] = node.children[1] = -1;
+        node.height = 0;
+        node.layers = node.masks = 0x00;
+        node.body = NULL;
+        return id;
+    };
+
+    void free_node(int32_t id) {
+        this->_nodes[id].body = NULL;
+        this->_nodes[id].parent = this->_free;
+        this->_free = id;
+    };
+
+    void refit(int32_t id) {
+        Node& node = this->_nodes[id];
+        const Node& first = this->_nodes[node.children[0]];
+        const Node& second = this->_nodes[node.children[1]];
+        node.fat = unite(first.fat, second.fat);
+        node.height = 1 + std::max(first.height, second.height);
+        node.layers = first.layers | second.layers;
+        node.masks = first.masks | second.masks;
+    };
+
+    //refits and balances the nodes from id up to the root
+    void fix_upwards(int32_t id) {
+        while (id != -1) {
+            id = this->balance(id);
+            this->refit(id);
+            id = this->_nodes[id].parent;
+        }
+    };
+
+    void insert_leaf(int32_t leaf) {
+        if (this->_root == -1) {
+            this->_root = leaf;
+            this->_nodes[leaf].parent = -1;
+            return;
+        }
+
+        //walk down to the sibling which makes the tree grow the least
+        const Box box = this->_nodes[leaf].fat;
+        int32_t id = this->_root;
+        while (!this->_nodes[id].is_leaf()) {
+            const Node& node = this->_nodes[id];
+            const float combined = perimeter(unite(node.fat, box));
+            const float cost = 2.0f * combined;
+            const float inheritance = 2.0f * (combined - perimeter(node.fat));
+
+            float childCosts[2];
+            for (int i = 0; i < 2; i++) {
+                const Node& child = this->_nodes[node.children[i]];
+                childCosts[i] = perimeter(unite(child.fat, box)) + inheritance;
+                if (!child.is_leaf())
+                    childCosts[i] -= perimeter(child.fat);
+            }
+            if ((cost < childCosts[0]) && (cost < childCosts[1]))
+                break;
+            id = (childCosts[0] < childCosts[1]) ? node.children[0] : node.children[1];
+        }
+
+        const int32_t sibling = id;
+        const int32_t oldParent = this->_nodes[sibling].parent;
+        const int32_t newParent = this->allocate_node();
+        Node& parent = this->_nodes[newParent];
+        parent.parent = oldParent;
+        parent.children[0] = sibling;
+        parent.children[1] = leaf;
+        if (oldParent == -1)
+            this->_root = newParent;
+        else
+            this->replace_child(oldParent, sibling, newParent);
+        this->_nodes[sibling].parent = newParent;
+        this->_nodes[leaf].parent = newParent;
+        this->fix_upwards(newParent);
+    };
+
+    void remove_leaf(int32_t leaf) {
+        if (leaf == this->_root) {
+            this->_root = -1;
+            return;
+        }
+
+        const int32_t parent = this->_nodes[leaf].parent;
+        const int32_t grandParent = this->_nodes[parent].parent;
+        const int32_t sibling = (this->_nodes[parent].children[0] == leaf)
+            ? this->_nodes[parent].children[1] : this->_nodes[parent].children[0];
+        this->_nodes[sibling].parent = grandParent;
+        if (grandParent == -1)
+            this->_root = sibling;
+        else
+            this->replace_child(grandParent, parent, sibling);
+        this->free_node(parent);
+        this->fix_upwards(grandParent);
+    };
+
+    void replace_child(int32_t parent, int32_t oldChild, int32_t newChild) {
+        Node& node = this->_nodes[parent];
+        if (node.children[0] == oldChild)
+            node.children[0] = newChild;
+        else
+            node.children[1] = newChild;
+    };
+
+    //if one child of id is more than one level higher than the other, the higher child is rotated up
+    //in place of id and gives id its lower grandchild; returns the node now in the place of id
+    int32_t balance(int32_t id) {
+        Node& node = this->_nodes[id];
+        if (node.is_leaf() || (node.height < 2))
+            return id;
+
+        const int32_t difference = this->_nodes[node.children[1]].height - this->_nodes[node.children[0]].height;
+        if ((difference >= -1) && (difference <= 1))
+            return id;
+
+        const int side = (difference > 1) ? 1 : 0;
+        const int32_t up = node.children[side];
+        Node& upper = this->_nodes[up];
+        const int32_t first = upper.children[0];
+        const int32_t second = upper.children[1];
+        const int32_t higher = (this->_nodes[first].height > this->_nodes[second].height) ? first : second;
+        const int32_t lower = (higher == first) ? second : first;
+
+        upper.parent = node.parent;
+        if (upper.parent == -1)
+            this->_root = up;
+        else
+            this->replace_child(upper.parent, id, up);
+
+        upper.children[0] = id;
+        upper.children[1] = higher;
+        node.parent = up;
+        node.children[side] = lower;
+        this->_nodes[lower].parent = id;
+        this->refit(id);
+        this->refit(up);
+        return up;
+    };
+
+    int32_t _root = -1;
+    int32_t _free = -1;
+    uint32_t _tick = 0;
+    std::vector<Node> _nodes;
+    std::unordered_map<Body2D*, int32_t> _leaves;
+    std::vector<int32_t> _stack;
 };
 
 struct Bodies {
@@ -1421,24 +2368,82 @@ public:
     };
 
     void add_body2d(Body2D* body) {
+        body->store_previous_state();
         _bodies.push_back(body);
+        this->_treeCurrent = false;
+        if (body->is_static())
+            _staticChanges++;
     }
 
     void init() {
         for (auto body : this->_bodies) {
             body->init();
+            body->store_previous_state();
         }
     }
-    void draw() {
+    //records shapes of all moving bodies at their interpolated position
+    void record(RenderCommandList* commands, float alpha) {
         for (auto body : this->_bodies) {
-            body->draw();
+            if (!body->is_static())
+                body->record(commands, alpha);
         }
     }
 
-    void act(float dt) {
+    void record_static(RenderCommandList* commands) {
         for (auto body : this->_bodies) {
-            body->act(dt);
+            if (body->is_static())
+                body->record(commands, 1.0f);
+        }
+    }
+
+    //grows whenever a static body is added or deleted
+    uint32_t get_static_changes() { return this->_staticChanges; }
+
+    void act(float dt) {
+        this->_treeCurrent = false;
+        {
+            ProfileScope profile(PROFILE_INTEGRATE);
+            for (auto body : this->_bodies) {
+                body->store_previous_state();
+            }
+            for (auto body : this->_bodies) {
+                body->act(dt);
+            }
         }
+        spawn_and_delete();
+
+        ProfileScope profile(PROFILE_COLLIDE);
+        check_collision();
+        this->_treeCurrent = false;
+    }
+
+    //bodies on any of layers whose bounds overlap the region, in the order of the bodies; the
+    //queries bring the tree up to date once after act() or a new body
+    void query_region(Point2DF topLeft, Point2DF bottomRight, uint16_t layers, std::vector<Body2D*>& found) {
+        this->update_tree();
+        this->_tree.query_region(topLeft, bottomRight, layers, this->_indices);
+        std::sort(this->_indices.begin(), this->_indices.end());
+        found.clear();
+        for (auto index : this->_indices)
+            found.push_back(this->_bodies[index]);
+    }
+
+    //the first body on any of layers the ray enters within length, NULL if there is none
+    Body2D* raycast(Point2DF origin, Point2DF direction, float length, uint16_t layers, float* distance = NULL) {
+        this->update_tree();
+        const int32_t index = this->_tree.raycast(origin, direction, length, layers, distance);
+        return (index != -1) ? this->_bodies[index] : NULL;
+    }
+
+    void update_tree() {
+        if (!this->_treeCurrent)
+            this->_tree.update(this->_bodies);
+        this->_treeCurrent = true;
+    }
+
+    //splits destroyed asteroids and removes deletable bodies
+    void spawn_and_delete() {
+        ProfileScope profile(PROFILE_SPAWN);
         for (int i = 0; i < this->_bodies.size(); i++) {
             if (this->_bodies.at(i)->is_deletable() == true) {
                 if (this->_bodies.at(i)->get_collision_mask() == 0x04) {
@@ -1468,33 +2473,86 @@ public:
                         this->add_body2d(asteroid);
                     }
                 }
+                if (this->_bodies.at(i)->is_static())
+                    _staticChanges++;
                 delete this->_bodies.at(i);
                 this->_bodies.erase(this->_bodies.begin() + i);
             }
         }
-
-        check_collision();
     }
 
+    //the broadphases find the pairs by the bounds at the start of the check and keep the order of
+    //the double loop, so every broadphase gives the same responses
     void check_collision() {
-        int32_t id = -1;
-        for (auto bodyLayer : this->_bodies) {
-            for (auto bodyMask : this->_bodies) {
-                if ((bodyLayer != bodyMask) && (bodyMask->is_collidable(bodyLayer))) {
-                    if (bodyLayer->is_box_collided(bodyMask)) {
-                        id = bodyMask->get_collided_shape_id(bodyLayer);
-                        if (id == -1)
-                            continue;
-                        else
-                            procedure_collision(bodyLayer, bodyMask, id);
-                    }
+        this->_buckets.update(this->_bodies);
+        if (get_broadphase() == BROADPHASE_BRUTE_FORCE) {
+            for (uint32_t i = 0; i < this->_bodies.size(); i++) {
+                for (uint32_t j : this->_buckets.get_masked(i)) {
+                    if (j != i)
+                        collide(this->_bodies[i], this->_bodies[j]);
                 }
             }
+            return;
+        }
+
+        if (get_broadphase() == BROADPHASE_SWEEP)
+            this->_sweep.find_pairs(this->_bodies, this->_pairs);
+        else if (get_broadphase() == BROADPHASE_GRID)
+            this->_grid.find_pairs(this->_bodies, this->_pairs);
+        else
+            this->_tree.find_pairs(this->_bodies, this->_pairs);
+        //the found pairs and the ones queued for moved bodies are merged in order, without repeats
+        size_t next = 0;
+        std::pair<uint32_t, uint32_t> previous(UINT32_MAX, UINT32_MAX);
+        while ((next < this->_pairs.size()) || !this->_movedPairs.empty()) {
+            std::pair<uint32_t, uint32_t> pair;
+            if (this->_movedPairs.empty() || ((next < this->_pairs.size()) && (this->_pairs[next] < this->_movedPairs.top())))
+                pair = this->_pairs[next++];
+            else {
+                pair = this->_movedPairs.top();
+                this->_movedPairs.pop();
+            }
+            if (pair == previous)
+                continue;
+            previous = pair;
+
+            Body2D* bodyLayer = this->_bodies[pair.first];
+            Body2D* bodyMask = this->_bodies[pair.second];
+            const Point2DF layerCoordinate = bodyLayer->get_coordinate();
+            const Point2DF maskCoordinate = bodyMask->get_coordinate();
+            collide(bodyLayer, bodyMask);
+            if (bodyLayer->get_coordinate() != layerCoordinate)
+                queue_moved_pairs(pair, pair.first);
+            if (bodyMask->get_coordinate() != maskCoordinate)
+                queue_moved_pairs(pair, pair.second);
+        }
+    }
+
+    //a body moved by a collision response is tested against every body in the rest of the pairs,
+    //as the double loop would test it at its new place
+    void queue_moved_pairs(std::pair<uint32_t, uint32_t> current, uint32_t moved) {
+        for (uint32_t i : this->_buckets.get_masked(moved)) {
+            if ((i != moved) && (std::make_pair(moved, i) > current))
+                this->_movedPairs.push(std::make_pair(moved, i));
+        }
+        for (uint32_t i : this->_buckets.get_layered(moved)) {
+            if ((i != moved) && (std::make_pair(i, moved) > current))
+                this->_movedPairs.push(std::make_pair(i, moved));
         }
     }
 
-    void procedure_collision(Body2D* layeredBody, Body2D* maskedBody, int32_t shape_id) {
-        layeredBody->procedure_collision(maskedBody, shape_id);
+    void collide(Body2D* bodyLayer, Body2D* bodyMask) {
+        int32_t id = -1;
+        Contact contact;
+        if (bodyLayer->is_box_collided(bodyMask)) {
+            id = bodyMask->get_collided_shape_id(bodyLayer, &contact);
+            if (id != -1)
+                procedure_collision(bodyLayer, bodyMask, id, contact);
+        }
+    }
+
+    void procedure_collision(Body2D* layeredBody, Body2D* maskedBody, int32_t shape_id, const Contact& contact) {
+        layeredBody->procedure_collision(maskedBody, shape_id, contact);
     }
 
     Body2D* get_body_at(int id) {
@@ -1507,6 +2565,16 @@ public:
 
 private:
     std::vector<Body2D*> _bodies;
+    uint32_t _staticChanges = 0;
+    LayerBuckets _buckets;
+    CollisionGrid _grid;
+    SweepAndPrune _sweep;
+    AabbTree _tree;
+    bool _treeCurrent = false;
+    std::vector<uint32_t> _indices;
+    std::vector<std::pair<uint32_t, uint32_t>> _pairs;
+    std::priority_queue<std::pair<uint32_t, uint32_t>, std::vector<std::pair<uint32_t, uint32_t>>,
+        std::greater<std::pair<uint32_t, uint32_t>>> _movedPairs;
 };
 
 
@@ -1547,10 +2615,19 @@ Bodies* scene_bodies;
 
 Bodies* lifes;
 
+//pipelined mode: frames recorded by the simulation thread, drawn by the render thread;
+//draw() uses the first one
+RenderCommandList frame_commands[PIPELINE_DEPTH];
+
+//static bodies of a frame, recorded only when they changed since the last recorded background
+RenderCommandList background_commands[PIPELINE_DEPTH];
+bool background_changed[PIPELINE_DEPTH];
+uint32_t recorded_static_changes = 0;
+
 // initialize game data in this function
 void initialize()
 {
-    srand(time(0));
+    srand(get_random_seed());
     scene_bodies = new NativeBody;
     scene_bodies->init();
     for (int i = 0; i < aster1_count; i++) {
@@ -1592,6 +2669,7 @@ void act(float dt)
     schedule_quit_game();
 
   if (is_key_pressed(VK_SPACE)) {
+      ProfileScope profile(PROFILE_SPAWN);
       Body2D* projectile = new Projectile;
       projectile->set_coordinate(scene_bodies->get_body_at(0)->get_start_point());
       projectile->init();
@@ -1600,26 +2678,59 @@ void act(float dt)
   }
   scene_bodies->act(dt);
 
-  if (scene_bodies->get_size() == 5)
-      finalize();
+  // game data is freed by finalize() once the engine leaves its loop
+  if (scene_bodies->get_size() == 5) {
+      schedule_quit_game();
+      return;
+  }
 
   if (Global::life_count < lifes->get_size())
       lifes->get_body_at(lifes->get_size() - 1)->delete_request();
 
-  if (Global::life_count < 1)
-      finalize();
+  if (Global::life_count < 1) {
+      schedule_quit_game();
+      return;
+  }
 
   lifes->act(dt);
 }
 
 // fill buffer in this function
-// uint32_t buffer[SCREEN_HEIGHT][SCREEN_WIDTH] - is an array of 32-bit colors (8 bits per R, G, B)
+// buffer[y][x] - 32-bit colors (8 bits per R, G, B), SCREEN_WIDTH x SCREEN_HEIGHT pixels
 void draw()
 {
-  // clear backbuffer
-  memset(buffer, 0, SCREEN_HEIGHT * SCREEN_WIDTH * sizeof(uint32_t));
-  scene_bodies->draw();
-  lifes->draw();
+  // the same as a pipelined frame, recorded and drawn at once
+  capture_frame(0);
+  draw_frame(0);
+}
+
+// pipelined mode: record the scene for draw_frame(), called right after act()
+void capture_frame(int slot)
+{
+  uint32_t staticChanges = scene_bodies->get_static_changes() + lifes->get_static_changes();
+  background_changed[slot] = (staticChanges != recorded_static_changes);
+  if (background_changed[slot]) {
+      background_commands[slot].clear();
+      scene_bodies->record_static(&background_commands[slot]);
+      lifes->record_static(&background_commands[slot]);
+      recorded_static_changes = staticChanges;
+  }
+
+  frame_commands[slot].clear();
+  scene_bodies->record(&frame_commands[slot], get_render_alpha());
+  lifes->record(&frame_commands[slot], get_render_alpha());
+}
+
+// pipelined mode: draw() of a captured frame, runs in parallel with act() of the next one
+void draw_frame(int slot)
+{
+  if (background_changed[slot]) {
+      begin_background();
+      background_commands[slot].submit();
+      end_background();
+  }
+  clear_buffer();
+  frame_commands[slot].submit();
 }
 
 // free game data in this function